@@ -27,11 +27,23 @@
 #define H3LIS331_CTRL_REG5 0b00000000      // CTRL_REG5 SleepToWake_OFF
 #define H3LIS331_STATUS_REG 0b11111111     // STATUS_REG Overrun Available
 
-class H3LIS331
+// SPIモード0、最大10MHz。アドレスのbit7で読み出し、bit6を立てると連続したレジスタにアクセスできる
+struct H3LIS331Device : SPICREATE::SPIDevice<SPI_MODE0, 10000000, 0x80, 0x40>
+{
+    // 加速度X, Y, Z (リトルエンディアン)
+    typedef SPICREATE::SPIBlock<H3LIS331_Data_Address, 6, SPICREATE::SPI_LITTLE_ENDIAN, 0, 2, 4> Data;
+    // クロックを確かめるための読み出し: WHO_AM_Iとbegin()で書くCTRL_REG1~5
+    typedef SPICREATE::SPIBlock<H3LIS331_WhoAmI_Address, 1, SPICREATE::SPI_LITTLE_ENDIAN> Id;
+    typedef SPICREATE::SPIBlock<H3LIS331_CTRL_REG1_Address, 5, SPICREATE::SPI_LITTLE_ENDIAN> Config;
+};
+
+class H3LIS331 : H3LIS331Device
 {
     int CS;
     int deviceHandle{-1};
     SPICREATE::SPICreate *H3LIS331SPI;
+    int dataSlot{-1};
+    uint8_t *queued_rx{NULL};
 
 public:
     void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000);
@@ -39,39 +51,34 @@ public:
     uint8_t WhoAmI();
     void Get(int16_t *rx);
     void Get2(int16_t *rx, uint8_t *rx_buf);
+    // Queue()でDMA転送を投げ、Collect()で完了を待って変換する
+    void Queue(uint8_t *rx_buf);
+    void Collect(int16_t *rx);
+    // begin()の後に呼ぶと、この配線で安定して読める一番速いクロックにする。そのクロックを返す
+    uint32_t probeClock(uint32_t maxHz = maxClock);
 };
 
 void H3LIS331::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
 {
     CS = cs;
     H3LIS331SPI = targetSPI;
-    spi_device_interface_config_t if_cfg = {};
-
-    // if_cfg.spics_io_num = cs;
-    if_cfg.pre_cb = NULL;
-    if_cfg.post_cb = NULL;
-    if_cfg.cs_ena_pretrans = 0;
-    if_cfg.cs_ena_posttrans = 0;
-
-    if_cfg.clock_speed_hz = freq;
-
-    if_cfg.mode = SPI_MODE0;
-    if_cfg.queue_size = 1;
-
-    if_cfg.pre_cb = csReset;
-    if_cfg.post_cb = csSet;
-
-    deviceHandle = H3LIS331SPI->addDevice(&if_cfg, cs);
-
-    // 1kHzにする
-    H3LIS331SPI->setReg(H3LIS331_CTRL_REG1_Address, H3LIS331_CTRL_REG1, deviceHandle);
-    H3LIS331SPI->setReg(H3LIS331_CTRL_REG2_Address, H3LIS331_CTRL_REG2, deviceHandle);
-    H3LIS331SPI->setReg(H3LIS331_CTRL_REG3_Address, H3LIS331_CTRL_REG3, deviceHandle);
-    // Init
-    H3LIS331SPI->setReg(H3LIS331_CTRL_REG4_Address, H3LIS331_CTRL_REG4_400G, deviceHandle);
-    // SleepAndWakeをOFFにする
-    H3LIS331SPI->setReg(H3LIS331_CTRL_REG5_Address, H3LIS331_CTRL_REG5, deviceHandle);
-    H3LIS331SPI->setReg(H3LIS331_STATUS_REG_Address, H3LIS331_STATUS_REG, deviceHandle);
+    deviceHandle = add(H3LIS331SPI, cs, freq);
+
+    // データ読み出し用の転送とDMAバッファは最初に1回だけ用意する
+    dataSlot = reserve<Data>(H3LIS331SPI, deviceHandle);
+
+    const uint8_t regs[][2] = {
+        // 1kHzにする
+        {H3LIS331_CTRL_REG1_Address, H3LIS331_CTRL_REG1},
+        {H3LIS331_CTRL_REG2_Address, H3LIS331_CTRL_REG2},
+        {H3LIS331_CTRL_REG3_Address, H3LIS331_CTRL_REG3},
+        // Init
+        {H3LIS331_CTRL_REG4_Address, H3LIS331_CTRL_REG4_400G},
+        // SleepAndWakeをOFFにする
+        {H3LIS331_CTRL_REG5_Address, H3LIS331_CTRL_REG5},
+        {H3LIS331_STATUS_REG_Address, H3LIS331_STATUS_REG},
+    };
+    H3LIS331SPI->setRegs(regs, 6, deviceHandle);
     return;
 }
 uint8_t H3LIS331::WhoImI()
@@ -80,59 +87,55 @@ uint8_t H3LIS331::WhoImI()
 }
 uint8_t H3LIS331::WhoAmI()
 {
-    return H3LIS331SPI->readByte(H3LIS331_WhoAmI_Address | 0x80, deviceHandle);
+    return read(H3LIS331SPI, H3LIS331_WhoAmI_Address, deviceHandle);
 }
 void H3LIS331::Get(int16_t *rx)
 {
     uint8_t rx_buf[6];
-    spi_transaction_t comm = {};
-    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
-    comm.length = (6) * 8;
-
-    uint16_t register_address = H3LIS331_Data_Address;
-    register_address |= 0x40;
-    comm.cmd = register_address | 0x80;
-
-    comm.tx_buffer = NULL;
-    comm.rx_buffer = rx_buf;
-    comm.user = (void *)CS;
-
-    spi_transaction_ext_t spi_transaction = {};
-    spi_transaction.base = comm;
-    spi_transaction.command_bits = 8;
-    H3LIS331SPI->pollTransmit((spi_transaction_t *)&spi_transaction, deviceHandle);
-    rx[0] = rx_buf[0];
-    rx[0] |= ((uint16_t)rx_buf[1]) << 8;
-    rx[1] = rx_buf[2];
-    rx[1] |= ((uint16_t)rx_buf[3]) << 8;
-    rx[2] = rx_buf[4];
-    rx[2] |= ((uint16_t)rx_buf[5]) << 8;
+    Get2(rx, rx_buf);
     return;
 }
 void H3LIS331::Get2(int16_t *rx, uint8_t *rx_buf)
 {
-    spi_transaction_t comm = {};
-    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
-    comm.length = (6) * 8;
-
-    uint16_t register_address = H3LIS331_Data_Address;
-    register_address |= 0x40;
-    comm.cmd = register_address | 0x80;
-
-    comm.tx_buffer = NULL;
-    comm.rx_buffer = rx_buf;
-    comm.user = (void *)CS;
-
-    spi_transaction_ext_t spi_transaction = {};
-    spi_transaction.base = comm;
-    spi_transaction.command_bits = 8;
-    H3LIS331SPI->pollTransmit((spi_transaction_t *)&spi_transaction, deviceHandle);
-    rx[0] = rx_buf[0];
-    rx[0] |= ((uint16_t)rx_buf[1]) << 8;
-    rx[1] = rx_buf[2];
-    rx[1] |= ((uint16_t)rx_buf[3]) << 8;
-    rx[2] = rx_buf[4];
-    rx[2] |= ((uint16_t)rx_buf[5]) << 8;
+    if (dataSlot < 0)
+    {
+        return;
+    }
+    // 転送からコピーまでバスを離さない (他のタスクのGet()がスロットを上書きしないように)
+    H3LIS331SPI->lock();
+    H3LIS331SPI->transfer((spi_transaction_t *)H3LIS331SPI->slotTransaction(dataSlot), deviceHandle);
+    memcpy(rx_buf, H3LIS331SPI->slotBuffer(dataSlot), Data::length);
+    Data::decode(rx_buf, rx);
+    H3LIS331SPI->unlock();
+    return;
+}
+void H3LIS331::Queue(uint8_t *rx_buf)
+{
+    if (dataSlot < 0)
+    {
+        return;
+    }
+    queued_rx = rx_buf;
+    H3LIS331SPI->queueTransmit((spi_transaction_t *)H3LIS331SPI->slotTransaction(dataSlot), deviceHandle);
     return;
 }
-#endif
\ No newline at end of file
+void H3LIS331::Collect(int16_t *rx)
+{
+    if (queued_rx == NULL)
+    {
+        return;
+    }
+    H3LIS331SPI->lock();
+    H3LIS331SPI->waitAll(deviceHandle);
+    uint8_t *rx_buf = queued_rx;
+    queued_rx = NULL;
+    memcpy(rx_buf, H3LIS331SPI->slotBuffer(dataSlot), Data::length);
+    Data::decode(rx_buf, rx);
+    H3LIS331SPI->unlock();
+    return;
+}
+uint32_t H3LIS331::probeClock(uint32_t maxHz)
+{
+    return probe<Id, Config>(H3LIS331SPI, deviceHandle, maxHz);
+}
+#endif
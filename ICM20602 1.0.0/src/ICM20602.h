@@ -1,31 +1,47 @@
 #pragma once
 
-#ifndef ICM_H
-#define ICM_H
+#ifndef ICM20602_H
+#define ICM20602_H
 #include <SPICREATE.h>
 #include <Arduino.h>
 
-#define ICM_CONFIG 0x1A
-#define ICM_PWR_MGMT_1 0x6B
-#define ICM_GYRO_CONFIG 0x1B
-#define ICM_ACC_CONFIG 0x1C
-#define ICM_16G 0b00011000
-#define ICM_8G 0b00010000
-#define ICM_4G 0b00001000
-#define ICM_2G 0b00000000
-#define ICM_2000dps 0b00011000
-#define ICM_1000dps 0b00010000
-#define ICM_500dps 0b00001000
-#define ICM_250dps 0b00000000
-#define ICM_WhoAmI_Adress 0x75
-#define ICM_Data_Adress 0x3B
-#define ICM_I2C_IF 0x70
+// SPI mode 0 or 3, up to 10 MHz for the sensor registers. Bit 7 of the address reads and
+// the address increments on its own.
+struct ICM20602Device : SPICREATE::SPIDevice<SPI_MODE3, 10000000, 0x80, 0>
+{
+    static constexpr uint8_t ICM_CONFIG = 0x1A;
+    static constexpr uint8_t ICM_PWR_MGMT_1 = 0x6B;
+    static constexpr uint8_t ICM_GYRO_CONFIG = 0x1B;
+    static constexpr uint8_t ICM_ACC_CONFIG = 0x1C;
+    static constexpr uint8_t ICM_16G = 0b00011000;
+    static constexpr uint8_t ICM_8G = 0b00010000;
+    static constexpr uint8_t ICM_4G = 0b00001000;
+    static constexpr uint8_t ICM_2G = 0b00000000;
+    static constexpr uint8_t ICM_2000dps = 0b00011000;
+    static constexpr uint8_t ICM_1000dps = 0b00010000;
+    static constexpr uint8_t ICM_500dps = 0b00001000;
+    static constexpr uint8_t ICM_250dps = 0b00000000;
+    static constexpr uint8_t ICM_WhoAmI_Adress = 0x75;
+    static constexpr uint8_t ICM_Data_Adress = 0x3B;
+    static constexpr uint8_t ICM_I2C_IF = 0x70;
+    static constexpr uint8_t ICM_INT_PIN_CFG = 0x37;
+    static constexpr uint8_t ICM_INT_ENABLE = 0x38;
+    static constexpr uint8_t ICM_DATA_RDY_INT_EN = 0x01;
+
+    // accel X, Y, Z, temperature, gyro X, Y, Z, big endian; the temperature is skipped
+    typedef SPICREATE::SPIBlock<ICM_Data_Adress, 14, SPICREATE::SPI_BIG_ENDIAN, 0, 2, 4, 8, 10, 12> Data;
+    // reads that check the clock: WHO_AM_I and CONFIG, GYRO_CONFIG, ACCEL_CONFIG as written in begin()
+    typedef SPICREATE::SPIBlock<ICM_WhoAmI_Adress, 1, SPICREATE::SPI_BIG_ENDIAN> Id;
+    typedef SPICREATE::SPIBlock<ICM_CONFIG, 3, SPICREATE::SPI_BIG_ENDIAN> Config;
+};
 
-class ICM
+class ICM20602 : ICM20602Device
 {
     int CS;
     int deviceHandle{-1};
     SPICREATE::SPICreate *ICMSPI;
+    int dataSlot{-1};
+    int captureSlot{-1};
 
 public:
     void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000);
@@ -33,72 +49,101 @@ public:
     void Get(int16_t *rx);
     void Get(int16_t *rx, uint8_t *rx_raw);
     float AccelNorm = 0.;
+    // Reads every sample as the INT pin (wired to intPin) signals it, from a capture task
+    // woken by the interrupt (SPICreate::captureOn). Starts the bus's capture task if needed.
+    bool beginCapture(int intPin);
+    // The next captured sample and the esp_timer_get_time() of its interrupt; false on timeout.
+    bool Read(int16_t *rx, int64_t *time, TickType_t ticksToWait = portMAX_DELAY);
+    // after begin(): sets the fastest clock that reads reliably on this wiring and returns it
+    uint32_t probeClock(uint32_t maxHz = maxClock);
 };
 
-IRAM_ATTR void ICM::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
+// ICM was the class name of every InvenSense driver. To keep it for one of them, define
+// ICM_CLASS as that class before the includes: #define ICM_CLASS ICM20602
+#define ICM_CLASS_ICM20602 1
+#if defined(ICM_CLASS) && SPICREATE_CONCAT(ICM_CLASS_, ICM_CLASS)
+typedef ICM20602 ICM;
+#endif
+
+void ICM20602::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
 {
     CS = cs;
     ICMSPI = targetSPI;
-    spi_device_interface_config_t if_cfg = {};
-
-    // if_cfg.spics_io_num = cs;
-    if_cfg.pre_cb = NULL;
-    if_cfg.post_cb = NULL;
-    if_cfg.cs_ena_pretrans = 0;
-    if_cfg.cs_ena_posttrans = 0;
-
-    if_cfg.clock_speed_hz = freq;
-
-    if_cfg.mode = SPI_MODE3; // 0 or 3
-    if_cfg.queue_size = 1;
-    if_cfg.spics_io_num = cs;
-    if_cfg.pre_cb = csReset;
-    if_cfg.post_cb = csSet;
-
-    deviceHandle = ICMSPI->addDevice(&if_cfg, cs);
-    ICMSPI->setReg(ICM_I2C_IF, 0b01000000, deviceHandle);
-    ICMSPI->setReg(ICM_CONFIG, 0x00, deviceHandle);
-    ICMSPI->setReg(ICM_PWR_MGMT_1, 0x01, deviceHandle);
-    ICMSPI->setReg(ICM_ACC_CONFIG, ICM_16G, deviceHandle);
-    ICMSPI->setReg(ICM_GYRO_CONFIG, ICM_2000dps, deviceHandle);
+    deviceHandle = add(ICMSPI, cs, freq);
+    dataSlot = reserve<Data>(ICMSPI, deviceHandle);
+    // CONFIG, GYRO_CONFIG and ACCEL_CONFIG are adjacent and go out as one burst
+    const uint8_t regs[][2] = {
+        {ICM_I2C_IF, 0b01000000},
+        {ICM_PWR_MGMT_1, 0x01},
+        {ICM_CONFIG, 0x00},
+        {ICM_GYRO_CONFIG, ICM_2000dps},
+        {ICM_ACC_CONFIG, ICM_16G},
+    };
+    ICMSPI->setRegs(regs, 5, deviceHandle);
     return;
 }
-IRAM_ATTR uint8_t ICM::WhoAmI()
+uint8_t ICM20602::WhoAmI()
 {
-    return ICMSPI->readByte(0x80 | ICM_WhoAmI_Adress, deviceHandle);
+    return read(ICMSPI, ICM_WhoAmI_Adress, deviceHandle);
 }
 
-IRAM_ATTR void ICM::Get(int16_t *rx)
+void ICM20602::Get(int16_t *rx)
 {
     uint8_t rx_raw[14];
     Get(rx, rx_raw);
 }
 
-IRAM_ATTR void ICM::Get(int16_t *rx, uint8_t *rx_raw)
+void ICM20602::Get(int16_t *rx, uint8_t *rx_raw)
 {
-    spi_transaction_t comm = {};
-    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
-    comm.length = (14) * 8;
-    comm.cmd = ICM_Data_Adress | 0x80;
-
-    comm.tx_buffer = NULL;
-    comm.rx_buffer = rx_raw;
-    comm.user = (void *)CS;
-
-    spi_transaction_ext_t spi_transaction = {};
-    spi_transaction.base = comm;
-    spi_transaction.command_bits = 8;
-    ICMSPI->pollTransmit((spi_transaction_t *)&spi_transaction, deviceHandle);
-
-    rx[0] = (int16_t)(rx_raw[0] << 8 | rx_raw[1]);
-    rx[1] = (int16_t)(rx_raw[2] << 8 | rx_raw[3]);
-    rx[2] = (int16_t)(rx_raw[4] << 8 | rx_raw[5]);
-    rx[3] = (int16_t)(rx_raw[8] << 8 | rx_raw[9]);
-    rx[4] = (int16_t)(rx_raw[10] << 8 | rx_raw[11]);
-    rx[5] = (int16_t)(rx_raw[12] << 8 | rx_raw[13]);
+    if (dataSlot < 0)
+    {
+        return;
+    }
+    // copy out of the slot before another task's Get() can reuse it
+    ICMSPI->lock();
+    ICMSPI->transfer((spi_transaction_t *)ICMSPI->slotTransaction(dataSlot), deviceHandle);
+    memcpy(rx_raw, ICMSPI->slotBuffer(dataSlot), Data::length);
+    Data::decode(rx_raw, rx);
+    ICMSPI->unlock();
 
     float Accel_Buf = rx[0] * rx[0] + rx[1] * rx[1] + rx[2] * rx[2];
     AccelNorm = (float)(sqrt((float)(Accel_Buf)) * 16. / 32768.);
     return;
 }
+
+bool ICM20602::beginCapture(int intPin)
+{
+    if (captureSlot < 0)
+    {
+        captureSlot = reserve<Data>(ICMSPI, deviceHandle);
+    }
+    if ((captureSlot < 0) || !ICMSPI->beginCapture())
+    {
+        return false;
+    }
+    // INT active high, push-pull, 50 us pulse per sample
+    const uint8_t regs[][2] = {
+        {ICM_INT_PIN_CFG, 0x00},
+        {ICM_INT_ENABLE, ICM_DATA_RDY_INT_EN},
+    };
+    ICMSPI->setRegs(regs, 2, deviceHandle);
+    return ICMSPI->captureOn(deviceHandle, captureSlot, intPin, RISING);
+}
+
+bool ICM20602::Read(int16_t *rx, int64_t *time, TickType_t ticksToWait)
+{
+    SPICREATE::SPICapture c;
+    if (!ICMSPI->getCapture(deviceHandle, &c, ticksToWait))
+    {
+        return false;
+    }
+    Data::decode(c.data, rx);
+    *time = c.time;
+    return true;
+}
+
+uint32_t ICM20602::probeClock(uint32_t maxHz)
+{
+    return probe<Id, Config>(ICMSPI, deviceHandle, maxHz);
+}
 #endif
@@ -1,59 +1,79 @@
 // version: 2.0.0
 #pragma once
 
-#ifndef ICM_H
-#define ICM_H
+#ifndef ICM20948_H
+#define ICM20948_H
 #include <Arduino.h>
 #include <SPICREATE.h>  // 2.0.0
 
-#define ICM_Data_Adress 0x2D    // BANK0
-#define ICM_GYRO_CONFIG 0x01    // BANK2
-#define ICM_WhoAmI_Adress 0x00  // BANK0 default0xEA
-#define ICM_ACC_CONFIG 0x14     // BANK2
-#define ICM_REG_BANK 0x7F       // default BANK0
-#define ICM_PWR_MGMT 0x06       // BANK0
-#define ICM_USER_CTRL 0x03      // BANK0
-#define ICM_16G 0b00000110
-#define ICM_8G 0b00000100
-#define ICM_4G 0b00000010
-#define ICM_2G 0b00000000
-#define ICM_2000dps 0b00000110
-#define ICM_1000dps 0b00000010
-#define ICM_500dps 0b00000100
-#define ICM_250dps 0b00000000
-#define ICM_USER_BANK0 0b00000000
-#define ICM_USER_BANK1 0b00010000
-#define ICM_USER_BANK2 0b00100000
-#define ICM_USER_BANK3 0b00110000
+// SPI mode 0 or 3, up to 7 MHz. Bit 7 of the address reads and the address
+// increments on its own.
+struct ICM20948Device
+    : SPICREATE::SPIDevice<SPI_MODE0, 7000000, 0x80, 0> {
+    static constexpr uint8_t ICM_Data_Adress = 0x2D;      // BANK0
+    static constexpr uint8_t ICM_GYRO_CONFIG = 0x01;      // BANK2
+    static constexpr uint8_t ICM_WhoAmI_Adress = 0x00;    // BANK0 default0xEA
+    static constexpr uint8_t ICM_ACC_CONFIG = 0x14;       // BANK2
+    static constexpr uint8_t ICM_REG_BANK = 0x7F;         // default BANK0
+    static constexpr uint8_t ICM_PWR_MGMT = 0x06;         // BANK0
+    static constexpr uint8_t ICM_USER_CTRL = 0x03;        // BANK0
+    static constexpr uint8_t ICM_16G = 0b00000110;
+    static constexpr uint8_t ICM_8G = 0b00000100;
+    static constexpr uint8_t ICM_4G = 0b00000010;
+    static constexpr uint8_t ICM_2G = 0b00000000;
+    static constexpr uint8_t ICM_2000dps = 0b00000110;
+    static constexpr uint8_t ICM_1000dps = 0b00000010;
+    static constexpr uint8_t ICM_500dps = 0b00000100;
+    static constexpr uint8_t ICM_250dps = 0b00000000;
+    static constexpr uint8_t ICM_USER_BANK0 = 0b00000000;
+    static constexpr uint8_t ICM_USER_BANK1 = 0b00010000;
+    static constexpr uint8_t ICM_USER_BANK2 = 0b00100000;
+    static constexpr uint8_t ICM_USER_BANK3 = 0b00110000;
 
-// #define ICM_2500deg 0x18
+    // static constexpr uint8_t ICM_2500deg = 0x18;
 
-#define ICM_INT_PIN_CFG 0x0F      // BANK0
-#define ICM_LP_CONFIG 0x05        // BANK0
-#define ICM_I2C_MST_STATUS 0x17   // BANK0
-#define ICM_I2C_MST_CTRL 0x01     // BANK3
-#define ICM_MagData_Address 0x3B  // BANK0
-#define ICM_I2C_SLV0_ADDR 0x03    // BANK3
-#define ICM_I2C_SLV0_REG 0x04     // BANK3
-#define ICM_I2C_SLV0_CTRL 0x05    // BANK3
-#define ICM_I2C_SLV0_DO 0x06      // BANK3
-#define ICM_I2C_SLV1_ADDR 0x07    // BANK3
-#define ICM_I2C_SLV1_REG 0x08     // BANK3
-#define ICM_I2C_SLV1_CTRL 0x09    // BANK3
-#define ICM_I2C_SLV1_DO 0x0A      // BANK3
-#define ICM_I2C_SLV2_ADDR 0x0B    // BANK3
-#define ICM_I2C_SLV2_REG 0x0C     // BANK3
-#define ICM_I2C_SLV2_CTRL 0x0D    // BANK3
-#define ICM_I2C_SLV2_DO 0x0E      // BANK3
-#define ICM_I2C_SLV3_ADDR 0x0F    // BANK3
-#define ICM_I2C_SLV3_REG 0x10     // BANK3
-#define ICM_I2C_SLV3_CTRL 0x11    // BANK3
-#define ICM_I2C_SLV3_DO 0x12      // BANK3
-#define ICM_I2C_SLV4_ADDR 0x13    // BANK3
-#define ICM_I2C_SLV4_REG 0x14     // BANK3
-#define ICM_I2C_SLV4_CTRL 0x15    // BANK3
-#define ICM_I2C_SLV4_DO 0x16      // BANK3
-#define ICM_I2C_SLV4_DI 0x17      // BANK3
+    static constexpr uint8_t ICM_INT_PIN_CFG = 0x0F;      // BANK0
+    static constexpr uint8_t ICM_LP_CONFIG = 0x05;        // BANK0
+    static constexpr uint8_t ICM_I2C_MST_STATUS = 0x17;   // BANK0
+    static constexpr uint8_t ICM_I2C_MST_CTRL = 0x01;     // BANK3
+    static constexpr uint8_t ICM_MagData_Address = 0x3B;  // BANK0
+    static constexpr uint8_t ICM_I2C_SLV0_ADDR = 0x03;    // BANK3
+    static constexpr uint8_t ICM_I2C_SLV0_REG = 0x04;     // BANK3
+    static constexpr uint8_t ICM_I2C_SLV0_CTRL = 0x05;    // BANK3
+    static constexpr uint8_t ICM_I2C_SLV0_DO = 0x06;      // BANK3
+    static constexpr uint8_t ICM_I2C_SLV1_ADDR = 0x07;    // BANK3
+    static constexpr uint8_t ICM_I2C_SLV1_REG = 0x08;     // BANK3
+    static constexpr uint8_t ICM_I2C_SLV1_CTRL = 0x09;    // BANK3
+    static constexpr uint8_t ICM_I2C_SLV1_DO = 0x0A;      // BANK3
+    static constexpr uint8_t ICM_I2C_SLV2_ADDR = 0x0B;    // BANK3
+    static constexpr uint8_t ICM_I2C_SLV2_REG = 0x0C;     // BANK3
+    static constexpr uint8_t ICM_I2C_SLV2_CTRL = 0x0D;    // BANK3
+    static constexpr uint8_t ICM_I2C_SLV2_DO = 0x0E;      // BANK3
+    static constexpr uint8_t ICM_I2C_SLV3_ADDR = 0x0F;    // BANK3
+    static constexpr uint8_t ICM_I2C_SLV3_REG = 0x10;     // BANK3
+    static constexpr uint8_t ICM_I2C_SLV3_CTRL = 0x11;    // BANK3
+    static constexpr uint8_t ICM_I2C_SLV3_DO = 0x12;      // BANK3
+    static constexpr uint8_t ICM_I2C_SLV4_ADDR = 0x13;    // BANK3
+    static constexpr uint8_t ICM_I2C_SLV4_REG = 0x14;     // BANK3
+    static constexpr uint8_t ICM_I2C_SLV4_CTRL = 0x15;    // BANK3
+    static constexpr uint8_t ICM_I2C_SLV4_DO = 0x16;      // BANK3
+    static constexpr uint8_t ICM_I2C_SLV4_DI = 0x17;      // BANK3
+
+    // accel X, Y, Z, gyro X, Y, Z, big endian
+    typedef SPICREATE::SPIBlock<ICM_Data_Adress, 12, SPICREATE::SPI_BIG_ENDIAN,
+                                0, 2, 4, 6, 8, 10>
+        Data;
+    // EXT_SLV_SENS_DATA: AK09916 ST1, X, Y, Z, TMPS, ST2, little endian
+    typedef SPICREATE::SPIBlock<ICM_MagData_Address, 9,
+                                SPICREATE::SPI_LITTLE_ENDIAN, 1, 3, 5>
+        Mag;
+    // reads that check the clock (BANK0): WHO_AM_I and USER_CTRL..PWR_MGMT_1
+    // as written in begin()
+    typedef SPICREATE::SPIBlock<ICM_WhoAmI_Adress, 1, SPICREATE::SPI_BIG_ENDIAN>
+        Id;
+    typedef SPICREATE::SPIBlock<ICM_USER_CTRL, 4, SPICREATE::SPI_BIG_ENDIAN>
+        Config;
+};
 
 #define AK09916_I2C_address 0x0C
 // ↓AK09916 registers
@@ -64,11 +84,16 @@
 #define AK09916_REG_CNTL2 0x31
 #define AK09916_REG_CNTL3 0x32
 
-class ICM {
+class ICM20948 : ICM20948Device {
     int CS;
     int deviceHandle{-1};
     SPICREATE::SPICreate *ICMSPI;
+    int dataSlot{-1};
+    int magSlot{-1};
+    uint8_t *queued_rx{NULL};
+    uint8_t bank{0xFF};  // last value written to ICM_REG_BANK, 0xFF: unknown
 
+    void selectBank(uint8_t userBank);
     uint8_t readMag(uint8_t reg);
     void writeMag(uint8_t reg, uint8_t data);
     void ICM_20948_i2c_controller_periph4_txn(
@@ -92,58 +117,88 @@ class ICM {
     uint8_t UserBank();
     void Get(int16_t *rx, uint8_t *rx_buf);
     void GetMag(int16_t *rx);
+    // non-blocking version of Get: Queue() starts the DMA transfer,
+    // Collect() waits for it and converts the result
+    void Queue(uint8_t *rx_buf);
+    void Collect(int16_t *rx);
     void magWhoAmI(uint8_t *who1, uint8_t *who2);  // shoud be 1:0x48, 2:0x09
     void startupMagnetometer();
+    // after begin(): sets the fastest clock that reads reliably on this wiring
+    // and returns it
+    uint32_t probeClock(uint32_t maxHz = maxClock);
 };
 
-void ICM::ICM_20948_i2c_controller_periph4_txn(uint8_t addr, uint8_t reg,
-                                               uint8_t *data, bool Rw) {
-    addr = (((Rw) ? 0x80 : 0x00) | addr);
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
-    ICMSPI->setReg(ICM_I2C_SLV4_ADDR, addr, deviceHandle);
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
-    ICMSPI->setReg(ICM_I2C_SLV4_REG, reg, deviceHandle);
-
-    uint8_t i2c_mst_status;
-    bool txn_failed = false;
+// ICM was the class name of every InvenSense driver. To keep it for one of
+// them, define ICM_CLASS as that class before the includes:
+// #define ICM_CLASS ICM20948
+#define ICM_CLASS_ICM20948 1
+#if defined(ICM_CLASS) && SPICREATE_CONCAT(ICM_CLASS_, ICM_CLASS)
+typedef ICM20948 ICM;
+#endif
 
+void ICM20948::selectBank(uint8_t userBank) {
+    if (bank == userBank) {
+        return;
+    }
+    ICMSPI->setReg(ICM_REG_BANK, userBank, deviceHandle);
+    bank = userBank;
+    return;
+}
+void ICM20948::ICM_20948_i2c_controller_periph4_txn(uint8_t addr,
+                                                    uint8_t reg,
+                                                    uint8_t *data, bool Rw) {
+    addr = (((Rw) ? 0x80 : 0x00) | addr);
+    ICMSPI->lock();  // bank select and access must not be split
+    selectBank(ICM_USER_BANK3);
+    uint8_t regs[4][2];
+    int n = 0;
+    regs[n][0] = ICM_I2C_SLV4_ADDR;
+    regs[n++][1] = addr;
+    regs[n][0] = ICM_I2C_SLV4_REG;
+    regs[n++][1] = reg;
     if (!Rw) {
-        ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
-        ICMSPI->setReg(ICM_I2C_SLV4_DO, *data, deviceHandle);
+        regs[n][0] = ICM_I2C_SLV4_DO;
+        regs[n++][1] = *data;
     }
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
-    ICMSPI->setReg(ICM_I2C_SLV4_CTRL, 0b10000000, deviceHandle);
-    delay(5);
+    regs[n][0] = ICM_I2C_SLV4_CTRL;  // starts the transaction, keep it last
+    regs[n++][1] = 0b10000000;
+    ICMSPI->setRegs(regs, n, deviceHandle);
+    ICMSPI->unlock();
+    delay(5);  // let other tasks use the bus while the I2C transfer runs
     if (Rw) {
-        ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
-        *data = ICMSPI->readByte(ICM_I2C_SLV4_DI | 0x80, deviceHandle);
+        ICMSPI->lock();
+        selectBank(ICM_USER_BANK3);
+        *data = read(ICMSPI, ICM_I2C_SLV4_DI, deviceHandle);
+        ICMSPI->unlock();
     }
     delay(1);
     return;
 }
-void ICM::ICM_20948_i2c_master_single_w(uint8_t addr, uint8_t reg,
-                                        uint8_t data) {
+void ICM20948::ICM_20948_i2c_master_single_w(uint8_t addr, uint8_t reg,
+                                             uint8_t data) {
     ICM_20948_i2c_controller_periph4_txn(addr, reg, &data, false);
     return;
 }
-uint8_t ICM::ICM_20948_i2c_master_single_r(uint8_t addr, uint8_t reg) {
+uint8_t ICM20948::ICM_20948_i2c_master_single_r(uint8_t addr,
+                                                uint8_t reg) {
     uint8_t data;
     ICM_20948_i2c_controller_periph4_txn(addr, reg, &data, true);
     return data;
 }
-uint8_t ICM::readMag(uint8_t reg) {
+uint8_t ICM20948::readMag(uint8_t reg) {
     uint8_t data = ICM_20948_i2c_master_single_r(AK09916_I2C_address, reg);
     return data;
 }
-void ICM::writeMag(uint8_t reg, uint8_t data) {
+void ICM20948::writeMag(uint8_t reg, uint8_t data) {
     ICM_20948_i2c_master_single_w(AK09916_I2C_address, reg, data);
     return;
 }
-void ICM::i2cControllerConfigurePeripheral(uint8_t peripheral, uint8_t addr,
-                                           uint8_t reg, uint8_t len, bool Rw,
-                                           bool enable, bool data_only,
-                                           bool grp, bool swap,
-                                           uint8_t dataOut) {
+void ICM20948::i2cControllerConfigurePeripheral(uint8_t peripheral,
+                                                uint8_t addr, uint8_t reg,
+                                                uint8_t len, bool Rw,
+                                                bool enable, bool data_only,
+                                                bool grp, bool swap,
+                                                uint8_t dataOut) {
     uint8_t periph_addr_reg;
     uint8_t periph_reg_reg;
     uint8_t periph_ctrl_reg;
@@ -178,77 +233,89 @@ void ICM::i2cControllerConfigurePeripheral(uint8_t peripheral, uint8_t addr,
             return;
             break;
     }
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
+    ICMSPI->lock();
+    selectBank(ICM_USER_BANK3);
     uint8_t address = addr;
     if (Rw) {
         address |= 0b10000000;
     }
-    ICMSPI->setReg(periph_addr_reg, address, deviceHandle);
+    uint8_t regs[4][2];
+    int n = 0;
+    regs[n][0] = periph_addr_reg;
+    regs[n++][1] = address;
+    regs[n][0] = periph_reg_reg;
+    regs[n++][1] = reg;
     if (!Rw) {
-        ICMSPI->setReg(periph_do_reg, dataOut, deviceHandle);
+        regs[n][0] = periph_do_reg;
+        regs[n++][1] = dataOut;
     }
-    ICMSPI->setReg(periph_reg_reg, reg, deviceHandle);
-    ICMSPI->setReg(periph_ctrl_reg, 0x89,
-                   deviceHandle);  //<-this value 0x89 is for only magnetrometer
+    regs[n][0] = periph_ctrl_reg;
+    regs[n++][1] = 0x89;  //<-this value 0x89 is for only magnetrometer
+    ICMSPI->setRegs(regs, n, deviceHandle);
+    ICMSPI->unlock();
     return;
 }
-void ICM::i2c_master_enable() {
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
-    uint8_t reg = ICMSPI->readByte(ICM_INT_PIN_CFG | 0x80, deviceHandle);
+void ICM20948::i2c_master_enable() {
+    ICMSPI->lock();
+    selectBank(ICM_USER_BANK0);
+    uint8_t reg = read(ICMSPI, ICM_INT_PIN_CFG, deviceHandle);
     reg &= 0b11111101;
     ICMSPI->setReg(ICM_INT_PIN_CFG, reg,
                    deviceHandle);  // disable I2C passthrough
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK3, deviceHandle);
+    selectBank(ICM_USER_BANK3);
     ICMSPI->setReg(ICM_I2C_MST_CTRL, 0x17, deviceHandle);
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
-    uint8_t ctrl = ICMSPI->readByte(ICM_USER_CTRL | 0x80, deviceHandle);
+    selectBank(ICM_USER_BANK0);
+    uint8_t ctrl = read(ICMSPI, ICM_USER_CTRL, deviceHandle);
     ctrl |= 0b00100000;
     ICMSPI->setReg(ICM_USER_CTRL, ctrl, deviceHandle);
+    ICMSPI->unlock();
     return;
 }
-void ICM::i2c_master_reset() {
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
-    uint8_t ctrl = ICMSPI->readByte(ICM_USER_CTRL | 0x80, deviceHandle);
+void ICM20948::i2c_master_reset() {
+    ICMSPI->lock();
+    selectBank(ICM_USER_BANK0);
+    uint8_t ctrl = read(ICMSPI, ICM_USER_CTRL, deviceHandle);
     ctrl |= 0b00000010;
     ICMSPI->setReg(ICM_USER_CTRL, ctrl, deviceHandle);
+    ICMSPI->unlock();
     return;
 }
-void ICM::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq) {
+void ICM20948::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq) {
     CS = cs;
     ICMSPI = targetSPI;
-    spi_device_interface_config_t if_cfg = {};
-
-    // if_cfg.spics_io_num = cs;
-    if_cfg.pre_cb = NULL;
-    if_cfg.post_cb = NULL;
-    if_cfg.cs_ena_pretrans = 0;
-    if_cfg.cs_ena_posttrans = 0;
-
-    if_cfg.clock_speed_hz = freq;
-
-    if_cfg.mode = SPI_MODE0;  // 0 or 3
-    if_cfg.queue_size = 1;
-
-    if_cfg.pre_cb = csReset;
-    if_cfg.post_cb = csSet;
+    // register writes auto-increment, so setRegs can merge neighbours
+    deviceHandle = add(ICMSPI, cs, freq);
 
-    deviceHandle = ICMSPI->addDevice(&if_cfg, cs);
+    // sample reads reuse these transactions and DMA buffers
+    dataSlot = reserve<Data>(ICMSPI, deviceHandle);
+    magSlot = reserve<Mag>(ICMSPI, deviceHandle);
 
-    ICMSPI->setReg(ICM_USER_CTRL, 0x10, deviceHandle);
-    ICMSPI->setReg(ICM_PWR_MGMT, 0x01, deviceHandle);  // turn off sleep mode
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK2, deviceHandle);
-    ICMSPI->setReg(ICM_ACC_CONFIG, ICM_16G, deviceHandle);
-    ICMSPI->setReg(ICM_GYRO_CONFIG, ICM_2000dps, deviceHandle);
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
+    bank = 0xFF;
+    selectBank(ICM_USER_BANK0);
+    const uint8_t bank0[][2] = {
+        {ICM_USER_CTRL, 0x10},
+        {ICM_PWR_MGMT, 0x01},  // turn off sleep mode
+    };
+    ICMSPI->setRegs(bank0, 2, deviceHandle);
+    selectBank(ICM_USER_BANK2);
+    const uint8_t bank2[][2] = {
+        {ICM_ACC_CONFIG, ICM_16G},
+        {ICM_GYRO_CONFIG, ICM_2000dps},
+    };
+    ICMSPI->setRegs(bank2, 2, deviceHandle);
+    selectBank(ICM_USER_BANK0);
     startupMagnetometer();
     delay(5);
     return;
 }
-uint8_t ICM::WhoAmI() {
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
-    return ICMSPI->readByte(0x80 | ICM_WhoAmI_Adress, deviceHandle);
+uint8_t ICM20948::WhoAmI() {
+    ICMSPI->lock();
+    selectBank(ICM_USER_BANK0);
+    uint8_t who = read(ICMSPI, ICM_WhoAmI_Adress, deviceHandle);
+    ICMSPI->unlock();
+    return who;
 }
-void ICM::startupMagnetometer() {
+void ICM20948::startupMagnetometer() {
     i2c_master_enable();
     resetMag();
     delay(10);
@@ -274,61 +341,72 @@ void ICM::startupMagnetometer() {
     return;
 }
 
-void ICM::magWhoAmI(uint8_t *who1, uint8_t *who2) {
+void ICM20948::magWhoAmI(uint8_t *who1, uint8_t *who2) {
     *who1 = readMag(AK09916_REG_WIA1);
     delay(1);
     *who2 = readMag(AK09916_REG_WIA2);
     return;
 }
-void ICM::resetMag() {
+void ICM20948::resetMag() {
     uint8_t SRST = 1;
     ICM_20948_i2c_master_single_w(AK09916_I2C_address, AK09916_REG_CNTL3, SRST);
     return;
 }
-void ICM::Get(int16_t *rx, uint8_t *rx_buf) {
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
-    // uint8_t rx_buf[12];
-    spi_transaction_t comm = {};
-    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
-    comm.length = (12) * 8;
-    comm.cmd = ICM_Data_Adress | 0x80;
-
-    comm.tx_buffer = NULL;
-    comm.rx_buffer = rx_buf;
-    comm.user = (void *)CS;
-
-    spi_transaction_ext_t spi_transaction = {};
-    spi_transaction.base = comm;
-    spi_transaction.command_bits = 8;
-    ICMSPI->pollTransmit((spi_transaction_t *)&spi_transaction, deviceHandle);
-
-    rx[0] = (rx_buf[0] << 8 | rx_buf[1]);
-    rx[1] = (rx_buf[2] << 8 | rx_buf[3]);
-    rx[2] = (rx_buf[4] << 8 | rx_buf[5]);
-    rx[3] = (rx_buf[6] << 8 | rx_buf[7]);
-    rx[4] = (rx_buf[8] << 8 | rx_buf[9]);
-    rx[5] = (rx_buf[10] << 8 | rx_buf[11]);
+void ICM20948::Get(int16_t *rx, uint8_t *rx_buf) {
+    if (dataSlot < 0) {
+        return;
+    }
+    ICMSPI->lock();
+    selectBank(ICM_USER_BANK0);
+    ICMSPI->transfer((spi_transaction_t *)ICMSPI->slotTransaction(dataSlot),
+                     deviceHandle);
+    memcpy(rx_buf, ICMSPI->slotBuffer(dataSlot), Data::length);
+    Data::decode(rx_buf, rx);
+    ICMSPI->unlock();
     return;
 }
-void ICM::GetMag(int16_t *rx) {
-    ICMSPI->setReg(ICM_REG_BANK, ICM_USER_BANK0, deviceHandle);
-    uint8_t rx_buf[9];
-    spi_transaction_t comm = {};
-    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
-    comm.length = (9) * 8;
-    comm.cmd = ICM_MagData_Address | 0x80;
-    comm.tx_buffer = NULL;
-    comm.rx_buffer = rx_buf;
-    comm.user = (void *)CS;
-
-    spi_transaction_ext_t spi_transaction = {};
-    spi_transaction.base = comm;
-    spi_transaction.command_bits = 8;
-    ICMSPI->pollTransmit((spi_transaction_t *)&spi_transaction, deviceHandle);
-
-    rx[0] = ((rx_buf[2] << 8) | rx_buf[1] & 0xFF);
-    rx[1] = ((rx_buf[4] << 8) | rx_buf[3] & 0xFF);
-    rx[2] = ((rx_buf[6] << 8) | rx_buf[5] & 0xFF);
+void ICM20948::GetMag(int16_t *rx) {
+    if (magSlot < 0) {
+        return;
+    }
+    ICMSPI->lock();
+    selectBank(ICM_USER_BANK0);
+    ICMSPI->transfer((spi_transaction_t *)ICMSPI->slotTransaction(magSlot),
+                     deviceHandle);
+    Mag::decode(ICMSPI->slotBuffer(magSlot), rx);
+    ICMSPI->unlock();
     return;
 }
+void ICM20948::Queue(uint8_t *rx_buf) {
+    if (dataSlot < 0) {
+        return;
+    }
+    ICMSPI->lock();
+    selectBank(ICM_USER_BANK0);
+    queued_rx = rx_buf;
+    ICMSPI->queueTransmit(
+        (spi_transaction_t *)ICMSPI->slotTransaction(dataSlot), deviceHandle);
+    ICMSPI->unlock();
+    return;
+}
+void ICM20948::Collect(int16_t *rx) {
+    if (queued_rx == NULL) {
+        return;
+    }
+    ICMSPI->lock();
+    ICMSPI->waitAll(deviceHandle);
+    uint8_t *rx_buf = queued_rx;
+    queued_rx = NULL;
+    memcpy(rx_buf, ICMSPI->slotBuffer(dataSlot), Data::length);
+    Data::decode(rx_buf, rx);
+    ICMSPI->unlock();
+    return;
+}
+uint32_t ICM20948::probeClock(uint32_t maxHz) {
+    ICMSPI->lock();
+    selectBank(ICM_USER_BANK0);
+    uint32_t hz = probe<Id, Config>(ICMSPI, deviceHandle, maxHz);
+    ICMSPI->unlock();
+    return hz;
+}
 #endif
@@ -9,7 +9,7 @@ namespace ICMPIN
     const int CS = 15;
 }
 
-ICM icm42688;
+ICM42688 icm42688;
 
 SPICREATE::SPICreate SPIC;
 
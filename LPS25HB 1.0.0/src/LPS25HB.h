@@ -1,8 +1,8 @@
 // version: 1.0.0
 #pragma once
 
-#ifndef LPS_H
-#define LPS_H
+#ifndef LPS25HB_H
+#define LPS25HB_H
 #include <SPICREATE.h> // 2.0.0
 #include <Arduino.h>
 
@@ -16,11 +16,23 @@
 #define LPS_Settig_Value 0x08
 #define LPS_WhoAmI_Adress 0x0F
 
-class LPS
+// SPI mode 0 or 3, up to 10 MHz. Bit 7 of the address reads, bit 6 makes multi-byte
+// accesses increment.
+struct LPS25HBDevice : SPICREATE::SPIDevice<SPI_MODE3, 10000000, 0x80, 0x40>
+{
+    // PRESS_OUT_XL, _L, _H: 24 bit pressure, little endian
+    typedef SPICREATE::SPIBlock<LPS_Data_Adress_0, 3, SPICREATE::SPI_LITTLE_ENDIAN> Data;
+    // reads that check the clock: WHO_AM_I and CTRL_REG1, CTRL_REG2 as written in begin()
+    typedef SPICREATE::SPIBlock<LPS_WhoAmI_Adress, 1, SPICREATE::SPI_LITTLE_ENDIAN> Id;
+    typedef SPICREATE::SPIBlock<LPS_WakeUp_Adress, 2, SPICREATE::SPI_LITTLE_ENDIAN> Config;
+};
+
+class LPS : LPS25HBDevice
 {
     int CS;
     int deviceHandle{-1};
     SPICREATE::SPICreate *LPSSPI;
+    int dataSlot{-1};
 
 public:
     uint32_t PlessureRaw;
@@ -28,6 +40,8 @@ public:
     void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000);
     uint8_t WhoAmI();
     void Get(uint8_t *rx);
+    // after begin(): sets the fastest clock that reads reliably on this wiring and returns it
+    uint32_t probeClock(uint32_t maxHz = maxClock);
     // (uint32_t)rx[2] << 16 | (uint32_t)rx[1] << 8 | (uint32_t)rx[0] means pressure
 };
 
@@ -35,23 +49,8 @@ void LPS::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
 {
     CS = cs;
     LPSSPI = targetSPI;
-    spi_device_interface_config_t if_cfg = {};
-
-    // if_cfg.spics_io_num = cs;
-    if_cfg.pre_cb = NULL;
-    if_cfg.post_cb = NULL;
-    if_cfg.cs_ena_pretrans = 0;
-    if_cfg.cs_ena_posttrans = 0;
-
-    if_cfg.clock_speed_hz = freq;
-
-    if_cfg.mode = SPI_MODE3;
-    if_cfg.queue_size = 1;
-
-    if_cfg.pre_cb = csReset;
-    if_cfg.post_cb = csSet;
-
-    deviceHandle = LPSSPI->addDevice(&if_cfg, cs);
+    deviceHandle = add(LPSSPI, cs, freq);
+    dataSlot = reserve<Data>(LPSSPI, deviceHandle);
     LPSSPI->setReg(LPS_Setting_Adress, LPS_Settig_Value, deviceHandle);
     LPSSPI->setReg(LPS_WakeUp_Adress, LPS_WakeUp_Value, deviceHandle);
 
@@ -59,31 +58,29 @@ void LPS::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
 }
 uint8_t LPS::WhoAmI()
 {
-    return LPSSPI->readByte(LPS_WhoAmI_Adress | 0x80, deviceHandle);
+    return read(LPSSPI, LPS_WhoAmI_Adress, deviceHandle);
     // registor 0x0F and you'll get 0d177 or 0xb1 or 0b10110001
 }
 
 void LPS::Get(uint8_t *rx)
 {
-    spi_transaction_t comm = {};
-    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
-    comm.length = (14) * 8;
-    comm.cmd = LPS_Data_Adress_0 | 0x80;
-
-    comm.tx_buffer = NULL;
-    comm.rx_buffer = NULL;
-    comm.user = (void *)CS;
-
-    spi_transaction_ext_t spi_transaction = {};
-    spi_transaction.base = comm;
-    spi_transaction.command_bits = 8;
-
-    rx[0] = LPSSPI->readByte(LPS_Data_Adress_0 | 0x80, deviceHandle);
-    rx[1] = LPSSPI->readByte(LPS_Data_Adress_1 | 0x80, deviceHandle);
-    rx[2] = LPSSPI->readByte(LPS_Data_Adress_2 | 0x80, deviceHandle);
+    if (dataSlot < 0)
+    {
+        return;
+    }
+    // 転送からコピーまでバスを離さない (他のタスクのGet()がスロットを上書きしないように)
+    LPSSPI->lock();
+    LPSSPI->transfer((spi_transaction_t *)LPSSPI->slotTransaction(dataSlot), deviceHandle);
+    memcpy(rx, LPSSPI->slotBuffer(dataSlot), Data::length);
+    LPSSPI->unlock();
     PlessureRaw = (uint32_t)rx[2] << 16 | (uint32_t)rx[1] << 8 | (uint32_t)rx[0];
     Plessure = (int)PlessureRaw * 100 / 4096;
     return;
 }
 
+uint32_t LPS::probeClock(uint32_t maxHz)
+{
+    return probe<Id, Config>(LPSSPI, deviceHandle, maxHz);
+}
+
 #endif
\ No newline at end of file
@@ -65,7 +65,8 @@ void Log67Serial::stopCommand()
 }
 
 // マルチタスク用
-// SPI Flashのデータを削除しているときのみ使用
+// Flash::erase()でSPI Flashのデータを削除しているときのみ使用
+// Flash::eraseAsync()なら呼び出し側のループが回り続けるので、そこでsendSerial2()を呼べばよい
 // 呼び出し方は以下の通り。適宜呼び出し側の変数を変える
 // xTaskCreatePinnedToCore(Log67Serial1.sendTask, "sendTask1", 8192, NULL, 2, &taskHandle, 0);
 void Log67Serial::sendTask(void *pvParameters)
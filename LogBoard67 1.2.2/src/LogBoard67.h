@@ -13,18 +13,83 @@
 
 // センサのクラス
 H3LIS331 H3lis331;
-ICM icm20948;
+ICM20948 icm20948;
 LPS Lps25;
 Flash flash1;
 
 // Timerクラスのインスタンス化
 Log67Timer timer;
 
+// バスの予算。RoutineWork()の転送をバスごとに並べ、収まらない組み合わせはビルドで落とし、
+// 余裕が少なくなったら警告を出す。クロックはここで決め、LogBoard67Configの初期値になる
+// 周期・デバイスを変えたらここも合わせる。flashをセンサと同じバスにするときはflashBusの行をsensorBusへ移す
+namespace LogBoard67Budget
+{
+    constexpr uint32_t RATE = 1000;            // RoutineWork()の回数/秒
+    constexpr uint32_t ROW = 32;               // 1回分のバイト数
+    constexpr uint32_t LPS_EVERY = 20;         // 気圧はRoutineWork() 20回に1回
+    constexpr uint32_t SENSOR_CLOCK = 8000000; // LogBoard67Config::sensorFreqの初期値
+    constexpr uint32_t FLASH_CLOCK = 20000000; // LogBoard67Config::flashFreqの初期値
+    constexpr uint32_t PAGES = RATE * ROW / PAGE_LENGTH;
+    constexpr uint64_t FLASH_PAGE_PROGRAM_NS = 750000; // S25FL512Sのページ書き込み時間 (tPP) の最大値
+    constexpr uint32_t CHECKPOINT_PAGES = 64;          // このページ数ごとにチェックポイントを書く (約1秒)
+
+    // センサはコマンド1バイト + データ
+    constexpr SPICREATE::SPILoad sensorBus[] = {
+        SPICREATE::SPILoad(SPICREATE::spiMinClock(SENSOR_CLOCK, H3LIS331Device::maxClock),
+                           H3LIS331Device::Data::length + 1, RATE),
+        SPICREATE::SPILoad(SPICREATE::spiMinClock(SENSOR_CLOCK, ICM20948Device::maxClock),
+                           ICM20948Device::Data::length + 1, RATE),
+        SPICREATE::SPILoad(SPICREATE::spiMinClock(SENSOR_CLOCK, LPS25HBDevice::maxClock),
+                           LPS25HBDevice::Data::length + 1, RATE / LPS_EVERY),
+    };
+    // 1ページ = WREN + 4PP (コマンド1バイト + アドレス4バイト + データ) + tPP後のRDSR
+    constexpr SPICREATE::SPILoad flashBus[] = {
+        SPICREATE::SPILoad(FLASH_CLOCK, 1, PAGES),
+        SPICREATE::SPILoad(FLASH_CLOCK, 1 + ADDRESS_LENGTH / 8 + PAGE_LENGTH, PAGES),
+        SPICREATE::SPILoad(FLASH_CLOCK, 2, PAGES),
+    };
+
+    static_assert(PAGE_LENGTH % ROW == 0, "1ページに行がちょうど収まらない");
+    static_assert(SPICREATE::spiUtilization(sensorBus) <= 500000, "センサのバスの使用率が50%を超える");
+    static_assert(SPICREATE::spiWorstLatencyNs(sensorBus) <= 1000000000ULL / RATE / 4,
+                  "センサの読み出しが周期の1/4を超えて待たされうる");
+    static_assert(SPICREATE::spiUtilization(flashBus) <= 500000, "flashのバスの使用率が50%を超える");
+    static_assert(SPICREATE::spiFlashUtilization(PAGES, FLASH_PAGE_PROGRAM_NS) <= 800000,
+                  "ページの書き込みがデータの溜まる速さに追いつかない");
+    // 落とすほどではないが余裕が半分を切ったもの
+    SPI_BUDGET_WARN(SPICREATE::spiUtilization(sensorBus) <= 250000, "センサのバスの使用率が25%を超える");
+    SPI_BUDGET_WARN(SPICREATE::spiWorstLatencyNs(sensorBus) <= 1000000000ULL / RATE / 8,
+                    "センサの読み出しが周期の1/8を超えて待たされうる");
+    SPI_BUDGET_WARN(SPICREATE::spiUtilization(flashBus) <= 250000, "flashのバスの使用率が25%を超える");
+    SPI_BUDGET_WARN(SPICREATE::spiFlashUtilization(PAGES, FLASH_PAGE_PROGRAM_NS) <= 400000,
+                    "ページの書き込みがデータの溜まる速さの半分を超える");
+}
+
+// どのデバイスをどのバスにつなぐか。バスのbegin()は先に済ませておく
+// flashSPIをsensorSPIと別のバスにすると (HSPIとVSPI)、ページの転送がセンサの読み出しを
+// 待たせることはない。同じバスにしてもよい
+struct LogBoard67Config
+{
+    SPICREATE::SPICreate *sensorSPI;
+    SPICREATE::SPICreate *flashSPI;
+    int h3lisCS;
+    int icmCS;
+    int lpsCS;
+    int flashCS;
+    // クロックの初期値はバスの予算のもの。下げると予算の確認から外れるので、begin()がSerialに警告を出す
+    uint32_t sensorFreq = LogBoard67Budget::SENSOR_CLOCK; // 各センサの上限で頭打ちになる
+    uint32_t flashFreq = LogBoard67Budget::FLASH_CLOCK;
+    // trueなら各デバイスのクロックをprobeClock()で上げられるところまで上げる (Serialに結果を出す)
+    bool probeClocks;
+};
+
 class LogBoard67
 {
 private:
     // SPI_FlashBuffは送る配列
-    uint8_t SPI_FlashBuff[256] = {};
+    // submitPage()がコピーするので、渡したらすぐに次のページを埋めてよい
+    uint8_t SPI_FlashBuff[PAGE_LENGTH] = {};
 
     // CountSPIFlashDataSetExistInBuffは列
     int CountSPIFlashDataSetExistInBuff = 0;
@@ -35,15 +100,89 @@ private:
     // 気圧の回数の測定(5回に1回)
     uint8_t count_lps = 0;
 
+    // センサのSPI。設定されていれば1回の測定の間バスを占有する
+    SPICREATE::SPICreate *SensorSPI = NULL;
+
+    // eraseAhead()で消した範囲の終わり。0ならチップ全体が消してあるものとする
+    uint32_t EraseLimit = 0;
+    // 書いているところからこのバイト数先まで消しておく (0なら消し足さない)
+    uint32_t EraseWindow = 0;
+    // 記録を止めたらtrue
+    bool Full = false;
+
 public:
+    void begin(SPICREATE::SPICreate *sensorSPI);
+    void begin(const LogBoard67Config &config);
     void RoutineWork();
+    // SPIFlashLatestAddressを決めた後、記録を始める前に呼ぶ。そこからbytes先までのセクタだけを消すので、
+    // 使いかけのチップでもチップ全体の消去 (数分) を待たずに記録を始められる
+    // その後はRoutineWork()が書いた分だけ1セクタずつ消し足し、いつもbytes先まで消してある状態にする
+    // 1セクタ (256 KB) の消去が約0.5秒、記録が32 KB/sなので、bytesは2セクタ以上にする
+    uint32_t eraseAhead(uint32_t bytes);
+    // 記録を止めていればtrue (チップの終わりに着いたか、消し足すのが記録に追いつかなかった)
+    bool full();
+    // 再起動したときに呼ぶ。チェックポイントからSPIFlashLatestAddressを決め、以降は
+    // CHECKPOINT_PAGESページごとにチェックポイントを書く。新しいログを始めるなら、この後に
+    // flash1.clearCheckpoint()を呼んでSPIFlashLatestAddressを決め直す
+    uint32_t restoreAddress();
 };
 
+// センサをつないだSPIを渡す (呼ばなくても動く)
+void LogBoard67::begin(SPICREATE::SPICreate *sensorSPI)
+{
+    SensorSPI = sensorSPI;
+}
+
+// センサとフラッシュをconfigのバスにつないで初期化する
+void LogBoard67::begin(const LogBoard67Config &config)
+{
+    H3lis331.begin(config.sensorSPI, config.h3lisCS, config.sensorFreq);
+    icm20948.begin(config.sensorSPI, config.icmCS, config.sensorFreq);
+    Lps25.begin(config.sensorSPI, config.lpsCS, config.sensorFreq);
+    flash1.begin(config.flashSPI, config.flashCS, config.flashFreq);
+    if ((config.sensorFreq < LogBoard67Budget::SENSOR_CLOCK) || (config.flashFreq < LogBoard67Budget::FLASH_CLOCK))
+    {
+        Serial.printf("LogBoard67: clock below LogBoard67Budget (sensor %u / %u, flash %u / %u Hz), bus budget not checked\n",
+                      config.sensorFreq, LogBoard67Budget::SENSOR_CLOCK, config.flashFreq, LogBoard67Budget::FLASH_CLOCK);
+    }
+    if (config.probeClocks)
+    {
+        Serial.printf("SPI clock: H3LIS331 %u, ICM20948 %u, LPS25HB %u, flash %u Hz\n", H3lis331.probeClock(),
+                      icm20948.probeClock(), Lps25.probeClock(), flash1.probeClock());
+    }
+    begin(config.sensorSPI);
+}
+
+uint32_t LogBoard67::restoreAddress()
+{
+    // チェックポイントを1回書きそびれても前向きの確認で足りるように2個分見る
+    return flash1.restoreFlashAddress(2 * LogBoard67Budget::CHECKPOINT_PAGES);
+}
+
+uint32_t LogBoard67::eraseAhead(uint32_t bytes)
+{
+    EraseWindow = bytes;
+    EraseLimit = flash1.eraseAhead(SPIFlashLatestAddress, bytes);
+    return EraseLimit;
+}
+
+bool LogBoard67::full()
+{
+    return Full;
+}
+
 void LogBoard67::RoutineWork()
 {
-    if (SPIFlashLatestAddress >= SPI_FLASH_MAX_ADDRESS)
+    if (Full)
     {
-        Serial.printf("SPIFlashLatestAddress: %u\n", SPIFlashLatestAddress);
+        return;
+    }
+    if (((EraseLimit != 0) && (SPIFlashLatestAddress + PAGE_LENGTH > EraseLimit)) ||
+        (SPIFlashLatestAddress >= flash1.dataEnd()))
+    {
+        Full = true;
+        Serial.printf("LogBoard67: logging stopped at %u (erased up to %u, data end %u)\n", SPIFlashLatestAddress,
+                      EraseLimit, flash1.dataEnd());
         // Serial2.write("SPI Flash is full");
         // Serial2.write("Started At: ");
         // Serial2.write(timer.start_time);
@@ -65,59 +204,84 @@ void LogBoard67::RoutineWork()
     uint8_t Icm20948_rx_buf[12] = {};
     uint8_t lps_rx[3] = {};
     // CountSPIFlashDataSetExistInBuffは列。indexは行。
-    // 時間をとる
-    for (int index = 0; index < 4; index++)
-    {
-        SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = 0xFF & (Record_time >> (8 * index));
-    }
 
-    // 加速度をとる
-    H3lis331.Get2(H3lisReceiveData, H3lis_rx_buf);
-    icm20948.Get(Icm20948ReceiveData, Icm20948_rx_buf);
-    for (int index = 4; index < 10; index++)
+    // 1回分の測定の間はバスを離さない
     {
-        SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = H3lis_rx_buf[index - 4];
-    }
+        SPICREATE::SPIBurst burst(SensorSPI);
 
-    // ICM20948の加速度をとる
-    for (int index = 10; index < 16; index++)
-    {
-        SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = Icm20948_rx_buf[index - 10];
-    }
+        // 加速度をとる
+        // バスは1つずつのデバイスにしか渡せないので、キューに入れても2つの転送は重ならない。順に読む
+        for (int index = 0; index < 4; index++)
+        {
+            SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = 0xFF & (Record_time >> (8 * index));
+        }
+        H3lis331.Get2(H3lisReceiveData, H3lis_rx_buf);
+        icm20948.Get(Icm20948ReceiveData, Icm20948_rx_buf);
+        for (int index = 4; index < 10; index++)
+        {
+            SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = H3lis_rx_buf[index - 4];
+        }
 
-    // ICM20948の角速度をとる
-    for (int index = 16; index < 22; index++)
-    {
-        SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = Icm20948_rx_buf[index - 10];
-    }
+        // ICM20948の加速度をとる
+        for (int index = 10; index < 16; index++)
+        {
+            SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = Icm20948_rx_buf[index - 10];
+        }
 
-    // ICM20948の地磁気をとる
-    // for (int index = 22; index < 28; index++)
-    // {
-    //   SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = Icm20948_rx_buf[index - 10];
-    // }
+        // ICM20948の角速度をとる
+        for (int index = 16; index < 22; index++)
+        {
+            SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = Icm20948_rx_buf[index - 10];
+        }
 
-    // LPSの気圧をとる
-    if (count_lps % 20 == 0)
-    {
-        Lps25.Get(lps_rx);
-        for (int index = 28; index < 31; index++)
+        // ICM20948の地磁気をとる
+        // for (int index = 22; index < 28; index++)
+        // {
+        //   SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = Icm20948_rx_buf[index - 10];
+        // }
+
+        // LPSの気圧をとる
+        if (count_lps % 20 == 0)
         {
-            SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = lps_rx[index - 28];
-            count_lps = 0;
+            Lps25.Get(lps_rx);
+            for (int index = 28; index < 31; index++)
+            {
+                SPI_FlashBuff[32 * CountSPIFlashDataSetExistInBuff + index] = lps_rx[index - 28];
+                count_lps = 0;
+            }
         }
     }
 
     count_lps++;
     CountSPIFlashDataSetExistInBuff++;
 
-    // 8個のデータが溜まったらSPIFlashに書き込む
-    if (CountSPIFlashDataSetExistInBuff >= 8)
+    // 書き込み中のページを進める (tPPが経つまではバスに何も送らない)
+    flash1.poll();
+
+    // 消してある範囲をEraseWindow先まで保つ。書き込み待ちのページがないときに1セクタの消去を始め、
+    // 消している間に渡したページはflash1が消去をサスペンドして書く
+    if (EraseWindow != 0)
     {
-        // データの書き込み
-        flash1.write(SPIFlashLatestAddress, SPI_FlashBuff);
+        flash1.eraseAheadAsync(SPIFlashLatestAddress, EraseWindow);
+        EraseLimit = flash1.erasedEnd();
+    }
+
+    // 1ページ分 (512バイトで16個) のデータが溜まったらSPIFlashに書き込む
+    if (CountSPIFlashDataSetExistInBuff >= (int)(PAGE_LENGTH / LogBoard67Budget::ROW))
+    {
+        // データの書き込み (完了は待たない)。2ページとも埋まっているときだけ前の書き込みを待つ
+        // wait()は裏で消しているセクタの終わりまで待ってしまうので、キューが空くまでだけ待つ
+        while (!flash1.submitPage(SPIFlashLatestAddress, SPI_FlashBuff))
+        {
+            delayMicroseconds(PAGE_PROGRAM_US / 8);
+        }
         // アドレスの更新
-        SPIFlashLatestAddress += 0x100;
+        SPIFlashLatestAddress += PAGE_LENGTH;
+        // キューが埋まっていて書けなければ次のチェックポイントまで飛ばす
+        if (SPIFlashLatestAddress % (LogBoard67Budget::CHECKPOINT_PAGES * PAGE_LENGTH) == 0)
+        {
+            flash1.submitCheckpoint(SPIFlashLatestAddress);
+        }
         // 列の番号の初期化
         CountSPIFlashDataSetExistInBuff = 0;
     }
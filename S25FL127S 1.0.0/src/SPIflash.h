@@ -15,6 +15,7 @@ using namespace arduino::esp32::spi::dma;
 #define CMD_P4E 0x20
 #define CMD_P8E 0x40
 #define CMD_BE 0x60
+#define CMD_SE 0xD8
 #define CMD_PP 0x02
 #define CMD_RDSR 0x05
 
@@ -23,10 +24,15 @@ class Flash
     int CS;
     int deviceHandle{-1};
     SPICREATE::SPICreate *flashSPI;
+    void eraseAt(uint8_t cmd, uint32_t addr);
 
 public:
     void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000);
     void erase();
+    // erases the 64 KB sector holding addr
+    void eraseSector(uint32_t addr);
+    // erases the 4 KB sector holding addr; P4E only reaches the parameter sectors of the hybrid layout
+    void eraseParameterSector(uint32_t addr);
     void write(uint32_t addr, uint8_t *tx);
     void read(uint32_t addr, uint8_t *rx);
 };
@@ -52,6 +58,8 @@ void Flash::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
     if_cfg.post_cb = csSet;
 
     deviceHandle = flashSPI->addDevice(&if_cfg, cs);
+    // split page reads so that sensor reads from other tasks get in between
+    flashSPI->setPriority(deviceHandle, SPICREATE::SPI_PRIORITY_LOW);
     uint8_t readStatus = flashSPI->readByte(CMD_RDSR, deviceHandle);
 
     while (readStatus != 0)
@@ -82,6 +90,36 @@ void Flash::erase()
     // Serial.println("Bulk Erased");
     return;
 }
+void Flash::eraseSector(uint32_t addr)
+{
+    eraseAt(CMD_SE, addr & ~0xFFFF);
+}
+void Flash::eraseParameterSector(uint32_t addr)
+{
+    eraseAt(CMD_P4E, addr & ~0xFFF);
+}
+void Flash::eraseAt(uint8_t cmd, uint32_t addr)
+{
+    if (flashSPI == NULL)
+    {
+        return;
+    }
+    spi_transaction_ext_t t = {};
+    t.base.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    t.base.cmd = cmd;
+    t.base.addr = addr;
+    t.command_bits = 8;
+    t.address_bits = 24;
+    // nothing from another task between WREN and the erase
+    flashSPI->lock();
+    flashSPI->sendCmd(CMD_WREN, deviceHandle);
+    flashSPI->transfer((spi_transaction_t *)&t, deviceHandle);
+    flashSPI->unlock();
+    while (flashSPI->readByte(CMD_RDSR, deviceHandle) & 0x01)
+    {
+        delay(10);
+    }
+}
 void Flash::write(uint32_t addr, uint8_t *tx)
 {
     flashSPI->sendCmd(CMD_WREN, deviceHandle);
@@ -98,7 +136,7 @@ void Flash::write(uint32_t addr, uint8_t *tx)
     spi_transaction.command_bits = 8;
     spi_transaction.address_bits = 24;
 
-    flashSPI->transmit((spi_transaction_t *)&spi_transaction, deviceHandle);
+    flashSPI->transfer((spi_transaction_t *)&spi_transaction, deviceHandle);
     return;
 }
 void Flash::read(uint32_t addr, uint8_t *rx)
@@ -116,7 +154,7 @@ void Flash::read(uint32_t addr, uint8_t *rx)
     spi_transaction.base = comm;
     spi_transaction.command_bits = 8;
     spi_transaction.address_bits = 24;
-    flashSPI->transmit((spi_transaction_t *)&spi_transaction, deviceHandle);
+    flashSPI->transfer((spi_transaction_t *)&spi_transaction, deviceHandle);
 }
 
 #endif
\ No newline at end of file
@@ -19,41 +19,173 @@ using namespace arduino::esp32::spi::dma;
 #define CMD_P8E 0x40
 
 #define CMD_BE 0x60
+#define CMD_4SE 0xDC
+// セクタ消去のサスペンドとレジューム。サスペンドしてから最大tSLでWIPが0になり、消しているセクタ以外に書ける
+// レジュームしてから次のサスペンドまではtRS空ける
+#define CMD_ERS 0x75
+#define CMD_ERR 0x7A
+#define ERASE_SUSPEND_US 45
+#define ERASE_RESUME_US 100
 #define CMD_PP 0x02
 #define CMD_4PP 0x12
 #define CMD_RDSR 0x05
+#define CMD_RDCR 0x35
+#define CMD_WRR 0x01
+#define CMD_4QOR 0x6C
+
+#define CR1_QUAD 0x02
+// ページ書き込み時間 (tPP) の典型値。これが経つまではWIPを見に行かない
+#define PAGE_PROGRAM_US 340
+// セクタ (256 KB、S25FL512Sは全部この大きさ) と消去時間 (tSE) の典型値
+#define SECTOR_SIZE 0x40000
+#define SECTOR_ERASE_US 520000
+// チップ全体の消去時間 (tBE) の典型値。消去中は1秒経ってから100msごとにWIPを見る
+#define BULK_ERASE_US 103000000UL
+#define BULK_ERASE_CHECK_US 100000
+// チェックポイント1個のバイト数。書き込むアドレスとそのビット反転 (4バイトずつ、下位バイトから) を
+// 2回繰り返す。ECCの単位 (16バイト) に合わせ、1個を1回のプログラムで書く
+#define CHECKPOINT_ENTRY 16
+// 4FAST_READと4QORのダミーサイクル (CR1のLCが初期値00のとき)
+#define READ_DUMMY_CYCLES 8
+// stream()が1回に渡すバイト数の上限 (バスのmax_transfer_szの4094以下で4の倍数)
+#define STREAM_CHUNK 4092
 
 #define ADDRESS_LENGTH 32
-// #define PAGE_LENGTH 512 // You can change this number to an aliquot part of 512.
-#define PAGE_LENGTH 256
+// 1回に書き込むバイト数。S25FL512Sの書き込みバッファは512バイトで、WRENとPPが512バイトに1回で済む
+// 512の約数にもできる (インクルードの前に#defineする)。書き込むアドレスはこの倍数にすること
+#ifndef PAGE_LENGTH
+#define PAGE_LENGTH 512
+#endif
 
-// SPI Flashの最大のアドレス (1回で1/2ページ書き込んでいる点に注意)
-// (512 * 1024 * 1024 / 8 / 256 ページ * 256) * 2 = 524288 * 256
-uint32_t SPI_FLASH_MAX_ADDRESS = 0x8000000;
+// SPI Flashの最大のアドレス (512 Mbit = 64 MB)。この先は0番地に戻ってしまう
+uint32_t SPI_FLASH_MAX_ADDRESS = 0x4000000;
 
 // SPIFlashLatestAddressは書き込むアドレス。初期値は0x000
 // 0x000はreboot対策のどこまでSPI Flashに書き込んだかを記録するページ
-// setup()で初期値でも0x100にしている
+// setup()で初期値でもPAGE_LENGTHにしている
 uint32_t SPIFlashLatestAddress = 0x000;
 
-uint8_t count = 1;
-uint8_t flashRead[256];
-uint8_t flashRead1[256];
-uint8_t flashRead2[256];
+// Flash::setReadMode()
+enum FlashReadMode
+{
+    FLASH_READ_NORMAL, // 4READ、全二重、50MHzまで
+    FLASH_READ_FAST,   // 4FAST_READ、半二重、ダミー8サイクル
+    FLASH_READ_QUAD,   // 4QOR、アドレスまで1本、データはIO0-IO3の4本。QUADビットを立てる
+};
+
+alignas(4) uint8_t flashRead[PAGE_LENGTH];
 
 class Flash
 {
     int CS;
     int deviceHandle{-1};
     SPICREATE::SPICreate *flashSPI;
+    int readSlot{-1};
+    int writeSlot{-1};
+    // FAST/QUADの読み出しは同じCSに半二重でもう1つ追加したデバイスで行う
+    int fastHandle{0};
+    int fastSlot{-1};
+    bool fastRead{false};
+    bool setQuadEnable();
+    // 書き込み中のページ。WRENとPPを送ってからWIPが0になるのを確かめるまでtrue
+    bool programming{false};
+    unsigned long programStart{0};
+    unsigned long programTime{PAGE_PROGRAM_US}; // この時間が経つまではRDSRを送らない
+    unsigned long programCheck{0};              // その後のRDSRの間隔
+    unsigned long lastCheck{0};
+    void startBusy(unsigned long first, unsigned long every);
+    // eraseAsync()の消去
+    bool bulkErasing{false};
+    void (*eraseDone)(void *){NULL};
+    void *eraseDoneArg{NULL};
+    uint32_t eraseEnd{0};                       // eraseAhead()で消した範囲の終わり
+    // eraseSectorAsync()の消去。ページが来たらpoll()がサスペンドして先に書き、書き終わったらレジュームする
+    bool sectorErasing{false};
+    bool eraseSuspended{false};
+    uint32_t erasingSector{0};
+    unsigned long eraseResumed{0};
+    unsigned long eraseRan{0}; // サスペンドまでに消去が進んだ時間の合計
+    bool busy();
+    void waitReady();
+    void startProgram(uint32_t addr, const uint8_t *tx, bool queued, size_t length = PAGE_LENGTH);
+    // submitPage()のページ。pageHeadが次に (または今) 書くページ
+    alignas(4) uint8_t pageBuff[2][PAGE_LENGTH] = {};
+    uint32_t pageAddr[2] = {};
+    size_t pageLength[2] = {};
+    int pageHead{0};
+    int pageCount{0};
+    bool pageInFlight{false};
+    void readInto(uint32_t addr, uint8_t *rx, size_t length);
+    bool pageWritten(uint32_t addr);
+    // stream()のバッファ。初めて呼ばれたときに確保する
+    uint8_t *streamBuff[2] = {};
+    // チェックポイントのセクタ (0なら使わない) と次に書くところ
+    uint32_t checkpointAddr{0};
+    uint32_t checkpointNext{0};
+    int checkpointState(const uint8_t *entry, uint32_t *addr);
+    int readCheckpoint(uint32_t addr, uint32_t *latest);
 
 public:
     void begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq = 8000000);
-    uint32_t checkAddress(uint32_t FlashAddress);
+    // 再起動したとき、書き込み済みの続きからSPIFlashLatestAddressを決め直す
     uint32_t setFlashAddress();
+    // チップの最後のセクタをチェックポイント (書き込むアドレスの記録) に使い、最後のチェックポイントから
+    // 最大scanPagesページ先まで見てSPIFlashLatestAddressを決める。チップがどれだけ埋まっていても
+    // 読むのは20回くらい。チェックポイントがなければ今のSPIFlashLatestAddressから探す
+    // 見つからなければ、またはセクタにチェックポイントではないもの (前のログなど) があればsetFlashAddress()で
+    // 探す。後者のときセクタは消さないので、チェックポイントを書くにはclearCheckpoint()を呼ぶ
+    // これ以降そのセクタにはログを書かない
+    uint32_t restoreFlashAddress(uint32_t scanPages = 128);
+    // 書き込むアドレスをチェックポイントに足す。submitPage()と同じキューに入れるので、先に渡した
+    // ページより後に書かれる。キューが埋まっているかセクタがいっぱいならfalse (次の機会に足せばよい)
+    bool submitCheckpoint(uint32_t addr);
+    // チェックポイントのセクタを消す。新しいログを始めるとき用
+    void clearCheckpoint();
+    // ログを書ける最後のアドレス。チェックポイントを使っていればそのセクタの手前まで
+    uint32_t dataEnd();
     void erase();
+    // チップ全体の消去を始めてすぐ戻る (S25FL512Sで約2分)。終わりはpoll()が見つけ、doneがあれば
+    // poll()の中で呼ぶ。その間もpoll()を呼び続けること。消去中の読み書きは終わるまで待たされる
+    bool eraseAsync(void (*done)(void *) = NULL, void *arg = NULL);
+    bool erasing();
+    // 消去の進み具合 (%)。tBEの典型値から見積もるので、終わるまでは99で止まる
+    int eraseProgress();
+    // addrを含むセクタを消す。Asyncは消し始めてすぐ戻り、終わりはpoll()かwait()で分かる
+    void eraseSector(uint32_t addr);
+    void eraseSectorAsync(uint32_t addr);
+    // addrからbytes先までを書き込める状態にしてその終わりを返す。チップ全体を消すより速い
+    // addrの途中のセクタは、その前半に今のログがあるので消さない (後半は消えているものとする)
+    // 前のeraseAhead()で消した範囲も消し直さない
+    uint32_t eraseAhead(uint32_t addr, uint32_t bytes);
+    // eraseAhead()の待たない版。addrからbytes先までで消していない最初のセクタの消去を始めてtrueを返す
+    // 消去中か書き込み待ちのページがあれば何もしない。ログを書きながら呼び続けると、消してある範囲が
+    // いつもbytesくらい先まである。消去中に渡したページはpoll()が消去をサスペンドして書く
+    bool eraseAheadAsync(uint32_t addr, uint32_t bytes);
+    // 消し終わった範囲の終わり (消去中のセクタは含まない)
+    uint32_t erasedEnd();
     void write(uint32_t addr, uint8_t *tx);
     void read(uint32_t addr, uint8_t *rx);
+    // addrからlengthバイト。回収したログを一気に読み出すとき用。rxは4バイト境界に置くと速い
+    // 終わるまでこのバスは他の転送に使えない
+    void read(uint32_t addr, uint8_t *rx, size_t length);
+    // addrからlengthバイトを1回の読み出しコマンドで読み、届いた順にsink(data, n, arg)に渡す (nはSTREAM_CHUNKまで)
+    // CSを下げたままにするので、コマンドとアドレスは最初の1回だけ。2つのバッファを交互に使い、sinkが
+    // 前のかたまりを処理している間に次を読む。終わるまでこのバスは他の転送に使えない
+    bool stream(uint32_t addr, size_t length, void (*sink)(const uint8_t *data, size_t n, void *arg), void *arg = NULL);
+    // read()の方法とクロックを変える。QUADはバスのsetQuadPins()とWP#/HOLD#の配線が要る
+    // 半二重なので全二重の上限 (IOMUXで40MHz、GPIOマトリクスで26.7MHz) にかからない
+    bool setReadMode(FlashReadMode mode, uint32_t freq = 40000000);
+    // 書き込みをキューに入れて戻る (前のページが書き込み中ならそれは待つ)。txはwait()か次のwriteAsync()が終わるまで書き換えないこと
+    void writeAsync(uint32_t addr, uint8_t *tx);
+    void wait();
+    // ページをコピーして受け取り、すぐに戻る。2ページ (書き込み中と待ち) が埋まっていればfalse
+    // 書き込みはpoll()が進める: 前のページのWIPが0になったら次のページのWRENとPPを送る
+    bool submitPage(uint32_t addr, const uint8_t *tx);
+    // 待たずに戻る。書き込みが終わっていないページの数を返す
+    int poll();
+    // begin()の後に呼ぶと、この配線で安定して読める一番速いクロックにする。そのクロックを返す
+    // RDIDと0番地の16バイトを読み比べる。4READの上限は50MHz
+    uint32_t probeClock(uint32_t maxHz = 50000000);
 };
 
 void Flash::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
@@ -76,7 +208,33 @@ void Flash::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
     if_cfg.pre_cb = csReset;
     if_cfg.post_cb = csSet;
 
-    deviceHandle = flashSPI->addDevice(&if_cfg, cs);
+    // setReadMode()のデバイスと同じCSを使うので、両方ともソフトウェアでCSを動かす (holdCS()もこれが要る)
+    deviceHandle = flashSPI->addDevice(&if_cfg, cs, true);
+    // ページの読み出しは分割して、その間にセンサの読み出しを入れられるようにする
+    flashSPI->setPriority(deviceHandle, SPICREATE::SPI_PRIORITY_LOW);
+
+    // 読み書きの転送は使い回す。読み出し先が4バイト境界にないときだけDMAバッファを経由する
+    readSlot = flashSPI->reserveSlot(deviceHandle, PAGE_LENGTH);
+    if (readSlot >= 0)
+    {
+        spi_transaction_ext_t *t = flashSPI->slotTransaction(readSlot);
+        t->base.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+        t->base.length = (PAGE_LENGTH)*8;
+        t->base.cmd = CMD_4READ;
+        t->command_bits = 8;
+        t->address_bits = ADDRESS_LENGTH;
+    }
+    writeSlot = flashSPI->reserveSlot(deviceHandle, 0);
+    if (writeSlot >= 0)
+    {
+        spi_transaction_ext_t *t = flashSPI->slotTransaction(writeSlot);
+        t->base.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+        t->base.length = (PAGE_LENGTH)*8;
+        t->base.cmd = CMD_4PP;
+        t->command_bits = 8;
+        t->address_bits = ADDRESS_LENGTH;
+    }
+
     uint8_t readStatus = flashSPI->readByte(CMD_RDSR, deviceHandle);
 
     while (readStatus != 0)
@@ -88,81 +246,164 @@ void Flash::begin(SPICREATE::SPICreate *targetSPI, int cs, uint32_t freq)
     return;
 }
 
-uint32_t Flash::checkAddress(uint32_t FlashAddress)
+// addrのページに書いてあるか。先頭は記録時刻 (下位バイトから) で、下位1バイトだけだと
+// 0xFFのこともあるので4バイト見る
+bool Flash::pageWritten(uint32_t addr)
+{
+    alignas(4) uint8_t head[4];
+    readInto(addr, head, sizeof(head));
+    return (head[0] & head[1] & head[2] & head[3]) != 0xFF;
+}
+
+// SPIFlashLatestAddressから後ろで最初の空きページを二分探索で探す。ログは先頭から隙間なく
+// 書いてあるので、loより前は書いてあり、hiから後ろは空いている。1回4バイトの読み出しを
+// ページ数の対数回 (S25FL512Sの512バイトページで17回) で終わる。全部書いてあればSPI_FLASH_MAX_ADDRESS
+uint32_t Flash::setFlashAddress()
 {
-    count++;
-    // if (count >= 20) // これ以上行くとページの途中を読むことになる。
-    // {
-    //   Serial.printf("FlashAddress: %u\n", FlashAddress);
-    //   return FlashAddress;
-    // }
-    if ((FlashAddress + 0x100) >= SPI_FLASH_MAX_ADDRESS)
+    if (flashSPI == NULL)
     {
-        // Serial.printf("FlashAddress: %u\n", FlashAddress);
-        // Serial.printf("count: %u\n", count);
-        return SPI_FLASH_MAX_ADDRESS;
+        return SPIFlashLatestAddress;
     }
-    Flash::read(FlashAddress, flashRead1);
-    delay(1);
-    Flash::read(FlashAddress + 0x100, flashRead2);
-    delay(1);
-    if (flashRead1[0] != 0xFF)
+    uint32_t lo = SPIFlashLatestAddress / PAGE_LENGTH;
+    uint32_t hi = dataEnd() / PAGE_LENGTH;
+    while (lo < hi)
     {
-        if (flashRead2[0] != 0xFF)
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (pageWritten(mid * PAGE_LENGTH))
         {
-            // ++
-            // Serial.println("---");
-            // uint32_t a = FlashAddress + SPI_FLASH_MAX_ADDRESS / pow(2, count);
-            // Serial.printf("FlashAddress: %u\n", a);
-            // Serial.printf("count: %u\n", count);
-            return checkAddress(FlashAddress + SPI_FLASH_MAX_ADDRESS / pow(2, count));
+            lo = mid + 1;
         }
         else
         {
-            // Serial.printf("FlashAddress: %u\n", FlashAddress);
-            return FlashAddress;
+            hi = mid;
         }
     }
-    else
+    SPIFlashLatestAddress = lo * PAGE_LENGTH;
+    return SPIFlashLatestAddress;
+}
+
+// チェックポイント1個を見る。消去済みなら0、正しければaddrに書き込むアドレスを入れて1、
+// それ以外 (書いている途中で電源が落ちた、チェックポイントではないものがある) なら-1
+int Flash::checkpointState(const uint8_t *entry, uint32_t *addr)
+{
+    bool blank = true;
+    for (int i = 0; i < CHECKPOINT_ENTRY; i++)
+    {
+        blank = blank && (entry[i] == 0xFF);
+    }
+    if (blank)
+    {
+        return 0;
+    }
+    uint32_t word[4];
+    for (int w = 0; w < 4; w++)
     {
-        if (flashRead2[0] != 0xFF)
+        const uint8_t *b = &entry[4 * w];
+        word[w] = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+    }
+    *addr = word[0];
+    bool valid = (word[0] == ~word[1]) && (word[2] == word[0]) && (word[3] == word[1]) &&
+                 (word[0] <= checkpointAddr) && (word[0] % PAGE_LENGTH == 0);
+    return valid ? 1 : -1;
+}
+
+// チェックポイントのaddrを読んで見る (checkpointState()と同じ値を返す)
+int Flash::readCheckpoint(uint32_t addr, uint32_t *latest)
+{
+    alignas(4) uint8_t entry[CHECKPOINT_ENTRY];
+    readInto(addr, entry, sizeof(entry));
+    return checkpointState(entry, latest);
+}
+
+uint32_t Flash::restoreFlashAddress(uint32_t scanPages)
+{
+    if ((flashSPI == NULL) || (readSlot < 0))
+    {
+        return SPIFlashLatestAddress;
+    }
+    checkpointAddr = SPI_FLASH_MAX_ADDRESS - SECTOR_SIZE;
+    // チェックポイントも先頭から隙間なく書いてあるので、最初の空きを二分探索で探す (14回)
+    uint32_t lo = 0;
+    uint32_t hi = SECTOR_SIZE / CHECKPOINT_ENTRY;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        uint32_t addr = 0;
+        if (readCheckpoint(checkpointAddr + mid * CHECKPOINT_ENTRY, &addr) != 0)
         {
-            // Serial.printf("FlashAddress: %u\n", FlashAddress);
-            // Serial.println("error");
-            return 0;
+            lo = mid + 1;
         }
         else
         {
-            // --
-            // Serial.printf("FlashAddress: %u\n", FlashAddress);
-            return checkAddress(FlashAddress - SPI_FLASH_MAX_ADDRESS / pow(2, count));
+            hi = mid;
         }
     }
-}
-
-uint32_t Flash::setFlashAddress()
-{
-    while (SPIFlashLatestAddress <= 0x1000)
+    // 壊れたものも書いた所には重ねて書かない
+    checkpointNext = checkpointAddr + lo * CHECKPOINT_ENTRY;
+    // 最後の1個は書いている途中で電源が落ちたかもしれないので、壊れていればその前を使う
+    uint32_t latest = 0;
+    int state = (lo >= 1) ? readCheckpoint(checkpointNext - CHECKPOINT_ENTRY, &latest) : 0;
+    if ((state < 0) && (lo >= 2))
     {
-        Flash::read(SPIFlashLatestAddress, flashRead);
-        // Serial.printf("SPIFlashLatestAddress: %u\n", SPIFlashLatestAddress);
-        // Serial.print(flashRead[0]);
-        delay(1);
-        // Serial.print("\n");
-        if (flashRead[0] == 0xFF)
+        state = readCheckpoint(checkpointNext - 2 * CHECKPOINT_ENTRY, &latest);
+        if (state < 0)
         {
-            Serial.println("255");
-            return SPIFlashLatestAddress;
+            // 2個続けて壊れているのはチェックポイントのセクタではない (前のログなど)。ここでは消さず、
+            // clearCheckpoint()を呼ぶまでチェックポイントは書かない
+            checkpointNext = checkpointAddr + SECTOR_SIZE;
+            return setFlashAddress();
         }
-        SPIFlashLatestAddress += 0x100;
-        if (SPIFlashLatestAddress >= SPI_FLASH_MAX_ADDRESS)
+    }
+    if (state > 0)
+    {
+        SPIFlashLatestAddress = (latest > SPIFlashLatestAddress) ? latest : SPIFlashLatestAddress;
+    }
+    // チェックポイントの後に書いたページ
+    for (uint32_t n = 0; n < scanPages; n++)
+    {
+        if ((SPIFlashLatestAddress >= checkpointAddr) || !pageWritten(SPIFlashLatestAddress))
         {
-            // Serial.printf("SPIFlashLatestAddress: %u\n", SPIFlashLatestAddress);
             return SPIFlashLatestAddress;
         }
+        SPIFlashLatestAddress += PAGE_LENGTH;
     }
-    SPIFlashLatestAddress = checkAddress(SPI_FLASH_MAX_ADDRESS / 2);
-    return SPIFlashLatestAddress;
+    return setFlashAddress();
+}
+
+bool Flash::submitCheckpoint(uint32_t addr)
+{
+    if ((writeSlot < 0) || (pageCount >= 2) || (checkpointAddr == 0) ||
+        (checkpointNext + CHECKPOINT_ENTRY > checkpointAddr + SECTOR_SIZE))
+    {
+        return false;
+    }
+    int i = (pageHead + pageCount) & 1;
+    for (int k = 0; k < 4; k++)
+    {
+        pageBuff[i][k] = pageBuff[i][k + 8] = (uint8_t)(addr >> (8 * k));
+        pageBuff[i][k + 4] = pageBuff[i][k + 12] = (uint8_t)(~addr >> (8 * k));
+    }
+    pageAddr[i] = checkpointNext;
+    pageLength[i] = CHECKPOINT_ENTRY;
+    pageCount++;
+    checkpointNext += CHECKPOINT_ENTRY;
+    poll();
+    return true;
+}
+
+void Flash::clearCheckpoint()
+{
+    if (checkpointAddr == 0)
+    {
+        return;
+    }
+    eraseSector(checkpointAddr);
+    checkpointNext = checkpointAddr;
+}
+
+uint32_t Flash::dataEnd()
+{
+    return (checkpointAddr != 0) ? checkpointAddr : SPI_FLASH_MAX_ADDRESS;
 }
 
 void Flash::erase()
@@ -172,54 +413,470 @@ void Flash::erase()
     {
         return;
     }
-
-    flashSPI->sendCmd(CMD_WREN, deviceHandle);
-    flashSPI->sendCmd(CMD_BE, deviceHandle);
-    uint8_t readStatus = flashSPI->readByte(CMD_RDSR, deviceHandle);
-    while (readStatus != 0)
+    eraseAsync();
+    while (bulkErasing)
     {
-        readStatus = flashSPI->readByte(CMD_RDSR, deviceHandle);
-        // Serial.print(",");
-        delay(100);
+        waitReady();
+        poll();
     }
     // Serial.println("Bulk Erased");
     return;
 }
-void Flash::write(uint32_t addr, uint8_t *tx)
+bool Flash::eraseAsync(void (*done)(void *), void *arg)
 {
+    if ((flashSPI == NULL) || bulkErasing)
+    {
+        return false;
+    }
+    wait();
+    flashSPI->lock();
     flashSPI->sendCmd(CMD_WREN, deviceHandle);
-    spi_transaction_t comm = {};
-    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
-    comm.length = (PAGE_LENGTH)*8;
-    comm.cmd = CMD_4PP;
-    comm.addr = addr;
-    comm.tx_buffer = tx;
-    comm.user = (void *)&CS;
-
-    spi_transaction_ext_t spi_transaction = {};
-    spi_transaction.base = comm;
-    spi_transaction.command_bits = 8;
-    spi_transaction.address_bits = ADDRESS_LENGTH;
-
-    flashSPI->transmit((spi_transaction_t *)&spi_transaction, deviceHandle);
+    flashSPI->sendCmd(CMD_BE, deviceHandle);
+    startBusy(1000000, BULK_ERASE_CHECK_US);
+    flashSPI->unlock();
+    eraseEnd = 0;
+    checkpointNext = checkpointAddr;
+    eraseDone = done;
+    eraseDoneArg = arg;
+    bulkErasing = true;
+    return true;
+}
+bool Flash::erasing()
+{
+    return bulkErasing;
+}
+int Flash::eraseProgress()
+{
+    if (!bulkErasing)
+    {
+        return 100;
+    }
+    unsigned long elapsed = micros() - programStart;
+    return (elapsed >= BULK_ERASE_US) ? 99 : (int)((uint64_t)elapsed * 100 / BULK_ERASE_US);
+}
+void Flash::write(uint32_t addr, uint8_t *tx)
+{
+    if (writeSlot < 0)
+    {
+        return;
+    }
+    waitReady();
+    startProgram(addr, tx, false);
     return;
 }
+void Flash::eraseSector(uint32_t addr)
+{
+    eraseSectorAsync(addr);
+    waitReady();
+    sectorErasing = false;
+}
+void Flash::eraseSectorAsync(uint32_t addr)
+{
+    if (flashSPI == NULL)
+    {
+        return;
+    }
+    wait();
+    spi_transaction_ext_t t = {};
+    t.base.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    t.base.cmd = CMD_4SE;
+    t.base.addr = addr & ~(SECTOR_SIZE - 1);
+    t.command_bits = 8;
+    t.address_bits = ADDRESS_LENGTH;
+    flashSPI->lock();
+    flashSPI->sendCmd(CMD_WREN, deviceHandle);
+    flashSPI->transfer((spi_transaction_t *)&t, deviceHandle);
+    startBusy(SECTOR_ERASE_US, SECTOR_ERASE_US / 8);
+    sectorErasing = true;
+    eraseSuspended = false;
+    erasingSector = addr & ~(SECTOR_SIZE - 1);
+    eraseResumed = micros();
+    eraseRan = 0;
+    flashSPI->unlock();
+}
+uint32_t Flash::eraseAhead(uint32_t addr, uint32_t bytes)
+{
+    uint32_t start = (addr + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+    uint32_t end = (addr + bytes < dataEnd()) ? addr + bytes : dataEnd();
+    eraseEnd = (eraseEnd < start) ? start : eraseEnd;
+    while (eraseEnd < end)
+    {
+        eraseSector(eraseEnd);
+        eraseEnd += SECTOR_SIZE;
+    }
+    return eraseEnd;
+}
+bool Flash::eraseAheadAsync(uint32_t addr, uint32_t bytes)
+{
+    uint32_t start = (addr + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+    uint32_t end = (addr + bytes < dataEnd()) ? addr + bytes : dataEnd();
+    if ((flashSPI == NULL) || sectorErasing || bulkErasing || (pageCount > 0) || busy())
+    {
+        return false;
+    }
+    eraseEnd = (eraseEnd < start) ? start : eraseEnd;
+    if (eraseEnd >= end)
+    {
+        return false;
+    }
+    eraseSectorAsync(eraseEnd);
+    eraseEnd += SECTOR_SIZE;
+    return true;
+}
+uint32_t Flash::erasedEnd()
+{
+    return sectorErasing ? eraseEnd - SECTOR_SIZE : eraseEnd;
+}
+// WRENとPPを送る。queuedならPPはキューに入れて待たない (回収は次のRDSRのときになる)
+void Flash::startProgram(uint32_t addr, const uint8_t *tx, bool queued, size_t length)
+{
+    // WRENと書き込みの間に他のタスクの転送を挟まない
+    flashSPI->lock();
+    flashSPI->sendCmd(CMD_WREN, deviceHandle);
+    spi_transaction_ext_t *t = flashSPI->slotTransaction(writeSlot);
+    t->base.addr = addr;
+    t->base.length = length * 8;
+    t->base.tx_buffer = tx;
+    if (queued)
+    {
+        flashSPI->queueTransmit((spi_transaction_t *)t, deviceHandle);
+    }
+    else
+    {
+        flashSPI->transfer((spi_transaction_t *)t, deviceHandle);
+    }
+    startBusy(PAGE_PROGRAM_US, PAGE_PROGRAM_US / 8);
+    flashSPI->unlock();
+}
+// WIPが立った。firstが経つまではRDSRを送らず、その後はevery間隔で送る
+void Flash::startBusy(unsigned long first, unsigned long every)
+{
+    programming = true;
+    programStart = micros();
+    lastCheck = programStart - every;
+    programTime = first;
+    programCheck = every;
+}
+// 書き込み中ならtrue。tPP (消去ならtSE) が経つまではRDSRを送らない
+bool Flash::busy()
+{
+    unsigned long now = micros();
+    if (!programming || (now - programStart < programTime) || (now - lastCheck < programCheck))
+    {
+        return programming;
+    }
+    lastCheck = now;
+    programming = (flashSPI->readByte(CMD_RDSR, deviceHandle) & 0x01) != 0;
+    return programming;
+}
+// 書き込みが終わるまで待つ。書き込み中はRDSR以外のコマンドをチップが無視するので、
+// 読み出しもWRENもこの後に送る
+void Flash::waitReady()
+{
+    while (programming)
+    {
+        unsigned long elapsed = micros() - programStart;
+        unsigned long wait = (elapsed < programTime) ? programTime - elapsed : (busy() ? programCheck : 0);
+        // 消去を待つ間は他のタスクに譲る
+        if (wait >= 2000)
+        {
+            delay(wait / 1000);
+        }
+        else if (wait > 0)
+        {
+            delayMicroseconds(wait);
+        }
+    }
+}
+bool Flash::submitPage(uint32_t addr, const uint8_t *tx)
+{
+    if ((writeSlot < 0) || (pageCount >= 2))
+    {
+        return false;
+    }
+    int i = (pageHead + pageCount) & 1;
+    memcpy(pageBuff[i], tx, PAGE_LENGTH);
+    pageAddr[i] = addr;
+    pageLength[i] = PAGE_LENGTH;
+    pageCount++;
+    poll();
+    return true;
+}
+int Flash::poll()
+{
+    if ((pageCount == 0) && !bulkErasing && !sectorErasing)
+    {
+        return pageCount;
+    }
+    // セクタの消去中にページが来たらサスペンドする。消しているセクタのページは消し終わるまで待つ
+    if (sectorErasing && !eraseSuspended && !pageInFlight && (pageCount > 0) &&
+        ((pageAddr[pageHead] & ~(SECTOR_SIZE - 1)) != erasingSector) &&
+        (micros() - eraseResumed >= ERASE_RESUME_US))
+    {
+        flashSPI->sendCmd(CMD_ERS, deviceHandle);
+        eraseSuspended = true;
+        eraseRan += micros() - eraseResumed;
+        startBusy(ERASE_SUSPEND_US, ERASE_SUSPEND_US / 4);
+    }
+    if (busy())
+    {
+        return pageCount;
+    }
+    // サスペンドせずにWIPが0になったら消し終わった
+    if (sectorErasing && !eraseSuspended)
+    {
+        sectorErasing = false;
+    }
+    if (bulkErasing)
+    {
+        bulkErasing = false;
+        if (eraseDone != NULL)
+        {
+            eraseDone(eraseDoneArg);
+        }
+    }
+    if (pageInFlight)
+    {
+        pageInFlight = false;
+        pageHead ^= 1;
+        pageCount--;
+    }
+    if (pageCount > 0)
+    {
+        startProgram(pageAddr[pageHead], pageBuff[pageHead], true, pageLength[pageHead]);
+        pageInFlight = true;
+    }
+    else if (eraseSuspended)
+    {
+        // 残りはtSEの典型値から見積もる。ページが来るたびにサスペンドしても終わりを見落とさない
+        unsigned long left = (eraseRan < SECTOR_ERASE_US) ? SECTOR_ERASE_US - eraseRan : 0;
+        flashSPI->sendCmd(CMD_ERR, deviceHandle);
+        eraseSuspended = false;
+        eraseResumed = micros();
+        startBusy((left > ERASE_RESUME_US) ? left : ERASE_RESUME_US, SECTOR_ERASE_US / 8);
+    }
+    return pageCount;
+}
 void Flash::read(uint32_t addr, uint8_t *rx)
 {
-    spi_transaction_t comm = {};
-    comm.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
-    comm.length = (PAGE_LENGTH)*8;
-    comm.cmd = CMD_4READ;
-    comm.addr = addr;
-    comm.tx_buffer = NULL;
-    comm.rx_buffer = rx;
-    comm.user = (void *)CS;
-
-    spi_transaction_ext_t spi_transaction = {};
-    spi_transaction.base = comm;
-    spi_transaction.command_bits = 8;
-    spi_transaction.address_bits = ADDRESS_LENGTH;
-    flashSPI->transmit((spi_transaction_t *)&spi_transaction, deviceHandle);
+    if (readSlot < 0)
+    {
+        return;
+    }
+    bool aligned = (((uintptr_t)rx) & 3) == 0;
+    readInto(addr, aligned ? rx : flashSPI->slotBuffer(readSlot), PAGE_LENGTH);
+    if (!aligned)
+    {
+        memcpy(rx, flashSPI->slotBuffer(readSlot), PAGE_LENGTH);
+    }
+}
+void Flash::read(uint32_t addr, uint8_t *rx, size_t length)
+{
+    if (readSlot < 0)
+    {
+        return;
+    }
+    // 1回の転送はバスのmax_transfer_sz (4094) まで。4の倍数で区切って境界を保つ
+    // 範囲の間はバスを離さないので、小分け (setPriority()のLOW) にせず4092バイトずつ送る
+    const size_t step = 4092;
+    flashSPI->lock();
+    for (size_t done = 0; done < length; done += step)
+    {
+        readInto(addr + done, rx + done, (length - done < step) ? length - done : step);
+    }
+    flashSPI->unlock();
+}
+bool Flash::stream(uint32_t addr, size_t length, void (*sink)(const uint8_t *data, size_t n, void *arg), void *arg)
+{
+    if ((readSlot < 0) || (sink == NULL))
+    {
+        return false;
+    }
+    if (length == 0)
+    {
+        return true;
+    }
+    if (streamBuff[0] == NULL)
+    {
+        streamBuff[0] = (uint8_t *)heap_caps_malloc(STREAM_CHUNK, MALLOC_CAP_DMA);
+        streamBuff[1] = (uint8_t *)heap_caps_malloc(STREAM_CHUNK, MALLOC_CAP_DMA);
+        if ((streamBuff[0] == NULL) || (streamBuff[1] == NULL))
+        {
+            heap_caps_free(streamBuff[0]);
+            heap_caps_free(streamBuff[1]);
+            streamBuff[0] = streamBuff[1] = NULL;
+            return false;
+        }
+    }
+    waitReady();
+    int handle = fastRead ? fastHandle : deviceHandle;
+    if (!flashSPI->holdCS(handle))
+    {
+        // ハードウェアCSではCSを下げたままにできないので、かたまりごとにコマンドを送る
+        for (size_t done = 0; done < length; done += STREAM_CHUNK)
+        {
+            size_t n = (length - done < STREAM_CHUNK) ? length - done : STREAM_CHUNK;
+            readInto(addr + done, streamBuff[0], n);
+            sink(streamBuff[0], n, arg);
+        }
+        return true;
+    }
+    // 最初のかたまりだけコマンドとアドレス (とダミー) を送り、後はデータだけを読む
+    // 待ちに入れるのは1つずつで、結果を受け取ってから次を入れる
+    spi_transaction_ext_t first = *flashSPI->slotTransaction(fastRead ? fastSlot : readSlot);
+    spi_transaction_ext_t more = first;
+    more.command_bits = 0;
+    more.address_bits = 0;
+    more.dummy_bits = 0;
+    size_t n[2] = {};
+    n[0] = (length < STREAM_CHUNK) ? length : STREAM_CHUNK;
+    first.base.addr = addr;
+    first.base.length = n[0] * 8;
+    first.base.rx_buffer = streamBuff[0];
+    flashSPI->queueTransmit((spi_transaction_t *)&first, handle);
+    size_t started = n[0];
+    for (int cur = 0; n[cur] > 0; cur ^= 1)
+    {
+        flashSPI->getResult(handle);
+        int next = cur ^ 1;
+        n[next] = (length - started < STREAM_CHUNK) ? length - started : STREAM_CHUNK;
+        if (n[next] > 0)
+        {
+            more.base.length = n[next] * 8;
+            more.base.rx_buffer = streamBuff[next];
+            flashSPI->queueTransmit((spi_transaction_t *)&more, handle);
+            started += n[next];
+        }
+        sink(streamBuff[cur], n[cur], arg);
+    }
+    flashSPI->releaseCS(handle);
+    return true;
+}
+// 読み出しの転送。デバイスの優先度がLOWなら、バスを持っていない限りSPICreateがchunkSizeずつに分ける
+void Flash::readInto(uint32_t addr, uint8_t *rx, size_t length)
+{
+    waitReady();
+    int slot = fastRead ? fastSlot : readSlot;
+    int handle = fastRead ? fastHandle : deviceHandle;
+    spi_transaction_ext_t *t = flashSPI->slotTransaction(slot);
+    t->base.addr = addr;
+    t->base.length = length * 8;
+    t->base.rx_buffer = rx;
+    flashSPI->transfer((spi_transaction_t *)t, handle);
+}
+bool Flash::setReadMode(FlashReadMode mode, uint32_t freq)
+{
+    if (flashSPI == NULL)
+    {
+        return false;
+    }
+    wait();
+    fastRead = false;
+    if (mode == FLASH_READ_NORMAL)
+    {
+        return true;
+    }
+    if ((mode == FLASH_READ_QUAD) && (!flashSPI->quadPins() || !setQuadEnable()))
+    {
+        return false;
+    }
+    if (fastHandle == 0)
+    {
+        spi_device_interface_config_t if_cfg = {};
+        if_cfg.clock_speed_hz = freq;
+        if_cfg.mode = SPI_MODE3;
+        if_cfg.flags = SPI_DEVICE_HALFDUPLEX;
+        if_cfg.queue_size = 1;
+        if_cfg.pre_cb = csReset;
+        if_cfg.post_cb = csSet;
+        fastHandle = flashSPI->addDevice(&if_cfg, CS, true);
+        fastSlot = (fastHandle != 0) ? flashSPI->reserveSlot(fastHandle, 0) : -1;
+        // 長い読み出しを分割してセンサの読み出しを間に入れるのは、こちらのデバイスでも同じ
+        if (fastHandle != 0)
+        {
+            flashSPI->setPriority(fastHandle, flashSPI->devicePriority(deviceHandle), flashSPI->chunkSize(deviceHandle));
+        }
+    }
+    else if (!flashSPI->setClock(fastHandle, freq))
+    {
+        return false;
+    }
+    if (fastSlot < 0)
+    {
+        return false;
+    }
+    spi_transaction_ext_t *t = flashSPI->slotTransaction(fastSlot);
+    t->base.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR | SPI_TRANS_VARIABLE_DUMMY |
+                    ((mode == FLASH_READ_QUAD) ? SPI_TRANS_MODE_QIO : 0);
+    t->base.cmd = (mode == FLASH_READ_QUAD) ? CMD_4QOR : CMD_4FAST_READ;
+    t->command_bits = 8;
+    t->address_bits = ADDRESS_LENGTH;
+    t->dummy_bits = READ_DUMMY_CYCLES;
+    fastRead = true;
+    return true;
+}
+// CR1のQUADビット (不揮発) を立てる。立っていれば書かない
+bool Flash::setQuadEnable()
+{
+    uint8_t cr = flashSPI->readByte(CMD_RDCR, deviceHandle);
+    if (cr & CR1_QUAD)
+    {
+        return true;
+    }
+    // WRRはデータ8ビットか16ビットの直後にCSが上がったときだけ実行されるので、ちょうど24ビットで送る
+    spi_transaction_t t = {};
+    t.flags = SPI_TRANS_USE_TXDATA;
+    t.length = 3 * 8;
+    t.tx_data[0] = CMD_WRR;
+    t.tx_data[1] = flashSPI->readByte(CMD_RDSR, deviceHandle) & ~0x03; // WIPとWELは書けない
+    t.tx_data[2] = cr | CR1_QUAD;
+    flashSPI->lock();
+    flashSPI->sendCmd(CMD_WREN, deviceHandle);
+    flashSPI->transmit(&t, deviceHandle);
+    flashSPI->unlock();
+    while (flashSPI->readByte(CMD_RDSR, deviceHandle) & 0x01)
+    {
+        delay(10);
+    }
+    return (flashSPI->readByte(CMD_RDCR, deviceHandle) & CR1_QUAD) != 0;
+}
+void Flash::writeAsync(uint32_t addr, uint8_t *tx)
+{
+    if (writeSlot < 0)
+    {
+        return;
+    }
+    waitReady();
+    startProgram(addr, tx, true);
+    return;
+}
+uint32_t Flash::probeClock(uint32_t maxHz)
+{
+    wait();
+    spi_transaction_ext_t probes[2] = {};
+    probes[0].base.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    probes[0].base.length = 3 * 8;
+    probes[0].base.cmd = CMD_RDID;
+    probes[0].command_bits = 8;
+    probes[1].base.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    probes[1].base.length = 16 * 8;
+    probes[1].base.cmd = CMD_4READ;
+    probes[1].base.addr = 0;
+    probes[1].command_bits = 8;
+    probes[1].address_bits = ADDRESS_LENGTH;
+    return flashSPI->probeClock(deviceHandle, probes, 2, maxHz);
+}
+void Flash::wait()
+{
+    // 先にpoll()を呼ぶと、セクタの消去中でもサスペンドしてページを書く
+    while ((pageCount > 0) || sectorErasing)
+    {
+        poll();
+        waitReady();
+    }
+    waitReady();
+    flashSPI->waitAll(deviceHandle);
+    return;
 }
 
-#endif
\ No newline at end of file
+#endif
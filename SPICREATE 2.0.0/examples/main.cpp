@@ -0,0 +1,79 @@
+// Software vs hardware chip select: time per sensor read for each driver.
+// Every sensor is added twice on the same pins, first with csReset/csSet, then with
+// setHardwareCS(). The software devices are measured before the hardware ones take the pins.
+#include <Arduino.h>
+#include <SPICREATE.h>
+#include <H3LIS331.h>
+#include <ICM20948.h>
+#include <LPS25HB.h>
+
+namespace PIN
+{
+    const int SCK = 14;
+    const int MISO = 12;
+    const int MOSI = 13;
+    const int H3LIS = 25;
+    const int ICM = 26;
+    const int LPS = 27;
+}
+
+const int N = 1000;
+
+SPICREATE::SPICreate SPIC;
+H3LIS331 h3lis[2];
+ICM20948 icm[2];
+LPS lps[2];
+
+float measure(int mode, int sensor)
+{
+    int16_t data[6];
+    uint8_t raw[12];
+    unsigned long start = micros();
+    for (int i = 0; i < N; i++)
+    {
+        switch (sensor)
+        {
+        case 0:
+            h3lis[mode].Get(data);
+            break;
+        case 1:
+            icm[mode].Get(data, raw);
+            break;
+        case 2:
+            lps[mode].Get(raw);
+            break;
+        }
+    }
+    return (float)(micros() - start) / N;
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    SPIC.begin(HSPI, PIN::SCK, PIN::MISO, PIN::MOSI);
+
+    float us[2][3];
+    for (int mode = 0; mode < 2; mode++)
+    {
+        SPIC.setHardwareCS(mode == 1);
+        h3lis[mode].begin(&SPIC, PIN::H3LIS);
+        icm[mode].begin(&SPIC, PIN::ICM);
+        lps[mode].begin(&SPIC, PIN::LPS);
+        for (int sensor = 0; sensor < 3; sensor++)
+        {
+            us[mode][sensor] = measure(mode, sensor);
+        }
+    }
+
+    const char *name[3] = {"H3LIS331", "ICM20948", "LPS25HB"};
+    Serial.printf("us per Get     software  hardware  saved\n");
+    for (int sensor = 0; sensor < 3; sensor++)
+    {
+        Serial.printf("%-12s %9.2f %9.2f %6.2f\n", name[sensor], us[0][sensor], us[1][sensor], us[0][sensor] - us[1][sensor]);
+    }
+}
+
+void loop()
+{
+    delay(1000);
+}
@@ -0,0 +1,902 @@
+// Host build of SPICREATE: ESP-IDF SPI master, Arduino core and FreeRTOS on Linux.
+#include "SPIHost.h"
+
+#include <stdarg.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace spihost
+{
+    static std::atomic<uint64_t> clock_ns{0};
+    static std::atomic<uint32_t> error_count{0};
+    static Timing timing_cfg;
+
+    // everything that moves on the bus or a pin is serialised, like the hardware
+    static std::recursive_mutex &hostLock()
+    {
+        static std::recursive_mutex m;
+        return m;
+    }
+
+    static const int PIN_COUNT = 64;
+    static uint8_t pin_level[PIN_COUNT];
+    static DeviceModel *pin_model[PIN_COUNT];
+    static void (*pin_isr[PIN_COUNT])(void);
+    static voidFuncPtrArg pin_isr_arg[PIN_COUNT];
+    static void *pin_arg[PIN_COUNT];
+    static thread_local bool in_isr = false;
+
+    static void report(const char *what)
+    {
+        error_count++;
+        fprintf(stderr, "[spihost] %s\n", what);
+    }
+
+    static void setPin(uint8_t pin, uint8_t val)
+    {
+        if (pin >= PIN_COUNT)
+        {
+            return;
+        }
+        std::lock_guard<std::recursive_mutex> guard(hostLock());
+        uint8_t old = pin_level[pin];
+        pin_level[pin] = val ? HIGH : LOW;
+        if ((pin_model[pin] != NULL) && (old != pin_level[pin]))
+        {
+            if (pin_level[pin] == LOW)
+            {
+                pin_model[pin]->select();
+            }
+            else
+            {
+                pin_model[pin]->deselect();
+            }
+        }
+    }
+
+    void attach(int csPin, DeviceModel *model)
+    {
+        std::lock_guard<std::recursive_mutex> guard(hostLock());
+        pin_model[csPin] = model;
+        pin_level[csPin] = HIGH;
+    }
+    void detach(int csPin)
+    {
+        std::lock_guard<std::recursive_mutex> guard(hostLock());
+        pin_model[csPin] = NULL;
+    }
+    Timing &timing()
+    {
+        return timing_cfg;
+    }
+    uint64_t nanos()
+    {
+        return clock_ns.load();
+    }
+    void advance(uint64_t ns)
+    {
+        clock_ns += ns;
+    }
+    void raiseInterrupt(int pin)
+    {
+        void (*handler)(void) = pin_isr[pin];
+        voidFuncPtrArg handlerArg = pin_isr_arg[pin];
+        if ((handler == NULL) && (handlerArg == NULL))
+        {
+            return;
+        }
+        in_isr = true;
+        if (handler != NULL)
+        {
+            handler();
+        }
+        else
+        {
+            handlerArg(pin_arg[pin]);
+        }
+        in_isr = false;
+    }
+    uint32_t errors()
+    {
+        return error_count.load();
+    }
+} // spihost
+
+using namespace spihost;
+
+// ---------------------------------------------------------------------------
+// SPI master
+
+struct spi_device_t
+{
+    spi_host_device_t host;
+    spi_device_interface_config_t cfg;
+    std::deque<spi_transaction_t *> results;
+};
+
+struct HostBus
+{
+    bool initialized;
+    spi_bus_config_t cfg;
+    spi_device_t *holder;
+    std::thread::id holderThread;
+};
+static HostBus buses[3];
+static std::mutex busMutex;
+static std::condition_variable busFree;
+
+// waits like the IDF bus lock; a device of the same thread holding the bus would hang forever
+static bool waitForBus(spi_device_t *dev)
+{
+    std::unique_lock<std::mutex> lk(busMutex);
+    HostBus &bus = buses[dev->host];
+    while ((bus.holder != NULL) && (bus.holder != dev))
+    {
+        if (bus.holderThread == std::this_thread::get_id())
+        {
+            report("transaction to a device while another device of this task holds the bus");
+            return false;
+        }
+        busFree.wait(lk);
+    }
+    return true;
+}
+
+static uint8_t shift(uint8_t out)
+{
+    uint8_t in = 0xFF; // MISO is pulled up when nobody drives it
+    int selected = 0;
+    for (int pin = 0; pin < PIN_COUNT; pin++)
+    {
+        if ((pin_model[pin] != NULL) && (pin_level[pin] == LOW))
+        {
+            in = pin_model[pin]->transfer(out);
+            selected++;
+        }
+    }
+    if (selected > 1)
+    {
+        report("more than one chip select is low");
+    }
+    return in;
+}
+
+// the checks IDF makes before it takes a transaction
+static esp_err_t checkTransaction(spi_device_t *dev, spi_transaction_t *t)
+{
+    if (!(t->flags & (SPI_TRANS_MODE_DIO | SPI_TRANS_MODE_QIO)))
+    {
+        return ESP_OK;
+    }
+    if (!(dev->cfg.flags & SPI_DEVICE_HALFDUPLEX))
+    {
+        report("dual/quad transaction on a full-duplex device");
+        return ESP_ERR_INVALID_ARG;
+    }
+    const spi_bus_config_t &bus = buses[dev->host].cfg;
+    if ((t->flags & SPI_TRANS_MODE_QIO) && ((bus.quadwp_io_num < 0) || (bus.quadhd_io_num < 0)))
+    {
+        report("quad transaction on a bus without WP/HD pins");
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+static void execute(spi_device_t *dev, spi_transaction_t *t, uint64_t overhead)
+{
+    if (!waitForBus(dev))
+    {
+        return;
+    }
+    std::lock_guard<std::recursive_mutex> guard(hostLock());
+    const spi_device_interface_config_t &cfg = dev->cfg;
+    spi_transaction_ext_t *ext = (spi_transaction_ext_t *)t;
+    int cmdBits = (t->flags & SPI_TRANS_VARIABLE_CMD) ? ext->command_bits : cfg.command_bits;
+    int addrBits = (t->flags & SPI_TRANS_VARIABLE_ADDR) ? ext->address_bits : cfg.address_bits;
+    int dummyBits = (t->flags & SPI_TRANS_VARIABLE_DUMMY) ? ext->dummy_bits : cfg.dummy_bits;
+    const uint8_t *tx = (t->flags & SPI_TRANS_USE_TXDATA) ? t->tx_data : (const uint8_t *)t->tx_buffer;
+    uint8_t *rx = (t->flags & SPI_TRANS_USE_RXDATA) ? t->rx_data : (uint8_t *)t->rx_buffer;
+    bool halfDuplex = (cfg.flags & SPI_DEVICE_HALFDUPLEX) != 0;
+    size_t rxLength = (t->rxlength != 0) ? t->rxlength : t->length;
+    // a late MISO sample takes the last bit of the previous byte
+    bool late = (timing_cfg.misoLimit != 0) && ((uint32_t)cfg.clock_speed_hz > timing_cfg.misoLimit);
+    uint8_t last = 0xFF;
+
+    if (cfg.pre_cb != NULL)
+    {
+        cfg.pre_cb(t);
+    }
+    if (cfg.spics_io_num >= 0)
+    {
+        setPin(cfg.spics_io_num, LOW);
+    }
+
+    for (int i = cmdBits / 8 - 1; i >= 0; i--)
+    {
+        shift((t->cmd >> (8 * i)) & 0xFF);
+    }
+    for (int i = addrBits / 8 - 1; i >= 0; i--)
+    {
+        shift((t->addr >> (8 * i)) & 0xFF);
+    }
+    for (int i = 0; i < dummyBits / 8; i++)
+    {
+        shift(0xFF);
+    }
+    uint64_t dataBits;
+    if (!halfDuplex)
+    {
+        size_t n = (t->length + 7) / 8;
+        size_t nrx = (rxLength + 7) / 8;
+        for (size_t i = 0; i < n; i++)
+        {
+            uint8_t in = shift((tx != NULL) ? tx[i] : 0x00);
+            if ((rx != NULL) && (i < nrx))
+            {
+                rx[i] = late ? ((last << 7) | (in >> 1)) : in;
+            }
+            last = in;
+        }
+        dataBits = t->length;
+    }
+    else
+    {
+        dataBits = 0;
+        if (tx != NULL)
+        {
+            for (size_t i = 0; i < (t->length + 7) / 8; i++)
+            {
+                shift(tx[i]);
+            }
+            dataBits += t->length;
+        }
+        if (rx != NULL)
+        {
+            for (size_t i = 0; i < (rxLength + 7) / 8; i++)
+            {
+                uint8_t in = shift(0xFF);
+                rx[i] = late ? ((last << 7) | (in >> 1)) : in;
+                last = in;
+            }
+            dataBits += rxLength;
+        }
+    }
+
+    int lines = (t->flags & SPI_TRANS_MODE_QIO) ? 4 : ((t->flags & SPI_TRANS_MODE_DIO) ? 2 : 1);
+    int addrLines = (t->flags & SPI_TRANS_MULTILINE_ADDR) ? lines : 1;
+    int cmdLines = (t->flags & SPI_TRANS_MULTILINE_CMD) ? lines : 1;
+    uint64_t clocks = cmdBits / cmdLines + addrBits / addrLines + dummyBits + dataBits / lines;
+    if (cfg.spics_io_num >= 0)
+    {
+        clocks += cfg.cs_ena_pretrans + cfg.cs_ena_posttrans;
+    }
+    uint64_t hz = (cfg.clock_speed_hz > 0) ? cfg.clock_speed_hz : SPI_MASTER_FREQ_8M;
+    advance(overhead + clocks * 1000000000ULL / hz);
+
+    if (cfg.spics_io_num >= 0)
+    {
+        setPin(cfg.spics_io_num, HIGH);
+    }
+    if (cfg.post_cb != NULL)
+    {
+        cfg.post_cb(t);
+    }
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *bus_config, int dma_chan)
+{
+    if ((host != SPI2_HOST) && (host != SPI3_HOST))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    std::lock_guard<std::mutex> lk(busMutex);
+    if (buses[host].initialized)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    buses[host].initialized = true;
+    buses[host].cfg = *bus_config;
+    buses[host].holder = NULL;
+    return ESP_OK;
+}
+esp_err_t spi_bus_free(spi_host_device_t host)
+{
+    std::lock_guard<std::mutex> lk(busMutex);
+    if (!buses[host].initialized)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    buses[host].initialized = false;
+    return ESP_OK;
+}
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *dev_config, spi_device_handle_t *handle)
+{
+    if (!buses[host].initialized)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if ((dev_config->clock_speed_hz <= 0) || (dev_config->clock_speed_hz > SPI_MASTER_FREQ_80M))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // full duplex cannot compensate the input delay: 40 MHz on the IOMUX pins, 26.7 MHz through
+    // the GPIO matrix
+    const spi_bus_config_t &bus = buses[host].cfg;
+    bool iomux = (host == SPI2_HOST) ? ((bus.sclk_io_num == 14) && (bus.miso_io_num == 12) && (bus.mosi_io_num == 13))
+                                     : ((bus.sclk_io_num == 18) && (bus.miso_io_num == 19) && (bus.mosi_io_num == 23));
+    if (!(dev_config->flags & SPI_DEVICE_HALFDUPLEX) &&
+        (dev_config->clock_speed_hz > (iomux ? SPI_MASTER_FREQ_40M : SPI_MASTER_FREQ_26M)))
+    {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    // same restriction as IDF: CS setup time needs the half-duplex engine
+    if ((dev_config->cs_ena_pretrans > 1) && !(dev_config->flags & SPI_DEVICE_HALFDUPLEX) &&
+        ((dev_config->command_bits != 0) || (dev_config->address_bits != 0)))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    spi_device_t *dev = new spi_device_t();
+    dev->host = host;
+    dev->cfg = *dev_config;
+    if (dev->cfg.spics_io_num >= 0)
+    {
+        setPin(dev->cfg.spics_io_num, HIGH);
+    }
+    *handle = dev;
+    return ESP_OK;
+}
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!handle->results.empty())
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    delete handle;
+    return ESP_OK;
+}
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t *trans_desc, TickType_t ticks_to_wait)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (checkTransaction(handle, trans_desc) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if ((int)handle->results.size() >= handle->cfg.queue_size)
+    {
+        report("queue full");
+        return ESP_ERR_TIMEOUT;
+    }
+    // queued transactions run at once; only their results wait to be collected
+    execute(handle, trans_desc, timing_cfg.interruptOverhead);
+    handle->results.push_back(trans_desc);
+    return ESP_OK;
+}
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t **trans_desc, TickType_t ticks_to_wait)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (handle->results.empty())
+    {
+        if (ticks_to_wait == portMAX_DELAY)
+        {
+            report("waiting for a result that was never queued");
+        }
+        return ESP_ERR_TIMEOUT;
+    }
+    *trans_desc = handle->results.front();
+    handle->results.pop_front();
+    return ESP_OK;
+}
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!handle->results.empty())
+    {
+        report("spi_device_transmit with queued transactions outstanding");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (checkTransaction(handle, trans_desc) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    execute(handle, trans_desc, timing_cfg.interruptOverhead);
+    return ESP_OK;
+}
+esp_err_t spi_device_polling_start(spi_device_handle_t handle, spi_transaction_t *trans_desc, TickType_t ticks_to_wait)
+{
+    if (handle == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (checkTransaction(handle, trans_desc) != ESP_OK)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    execute(handle, trans_desc, timing_cfg.pollingOverhead);
+    return ESP_OK;
+}
+esp_err_t spi_device_polling_end(spi_device_handle_t handle, TickType_t ticks_to_wait)
+{
+    return (handle == NULL) ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc)
+{
+    esp_err_t e = spi_device_polling_start(handle, trans_desc, portMAX_DELAY);
+    if (e != ESP_OK)
+    {
+        return e;
+    }
+    return spi_device_polling_end(handle, portMAX_DELAY);
+}
+esp_err_t spi_device_acquire_bus(spi_device_handle_t device, TickType_t wait)
+{
+    if (!waitForBus(device))
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    std::lock_guard<std::mutex> lk(busMutex);
+    buses[device->host].holder = device;
+    buses[device->host].holderThread = std::this_thread::get_id();
+    return ESP_OK;
+}
+void spi_device_release_bus(spi_device_handle_t dev)
+{
+    std::lock_guard<std::mutex> lk(busMutex);
+    if (buses[dev->host].holder != dev)
+    {
+        report("release of a bus that this device does not hold");
+        return;
+    }
+    buses[dev->host].holder = NULL;
+    busFree.notify_all();
+}
+int spi_get_actual_clock(int fapb, int hz, int duty_cycle)
+{
+    int div = (fapb + hz - 1) / hz;
+    return fapb / ((div < 1) ? 1 : div);
+}
+
+// ---------------------------------------------------------------------------
+// heap and timer
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return aligned_alloc(4, (size + 3) & ~(size_t)3);
+}
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    void *p = heap_caps_malloc(n * size, caps);
+    if (p != NULL)
+    {
+        memset(p, 0, n * size);
+    }
+    return p;
+}
+void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
+int64_t esp_timer_get_time()
+{
+    return (int64_t)(nanos() / 1000);
+}
+
+// ---------------------------------------------------------------------------
+// Arduino core
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    advance(timing_cfg.gpioWrite);
+    setPin(pin, val);
+}
+int digitalRead(uint8_t pin)
+{
+    return (pin < PIN_COUNT) ? pin_level[pin] : LOW;
+}
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode)
+{
+    pin_isr[pin] = handler;
+    pin_isr_arg[pin] = NULL;
+}
+void attachInterruptArg(uint8_t pin, voidFuncPtrArg handler, void *arg, int mode)
+{
+    pin_isr[pin] = NULL;
+    pin_isr_arg[pin] = handler;
+    pin_arg[pin] = arg;
+}
+void detachInterrupt(uint8_t pin)
+{
+    pin_isr[pin] = NULL;
+    pin_isr_arg[pin] = NULL;
+}
+unsigned long micros()
+{
+    return (unsigned long)(nanos() / 1000);
+}
+unsigned long millis()
+{
+    return (unsigned long)(nanos() / 1000000);
+}
+void delay(uint32_t ms)
+{
+    advance((uint64_t)ms * 1000000);
+    std::this_thread::yield();
+}
+void delayMicroseconds(uint32_t us)
+{
+    advance((uint64_t)us * 1000);
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t n = 0;
+    while (n < size)
+    {
+        write(buffer[n++]);
+    }
+    return n;
+}
+size_t Print::printf(const char *format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len < 0)
+    {
+        return 0;
+    }
+    if (len >= (int)sizeof(buf))
+    {
+        std::vector<char> big(len + 1);
+        va_start(args, format);
+        vsnprintf(big.data(), big.size(), format, args);
+        va_end(args);
+        return write((const uint8_t *)big.data(), len);
+    }
+    return write((const uint8_t *)buf, len);
+}
+size_t HardwareSerial::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    output.append((const char *)buffer, size);
+    if (echo)
+    {
+        fwrite(buffer, 1, size, stdout);
+    }
+    return size;
+}
+int HardwareSerial::read()
+{
+    if (input.empty())
+    {
+        return -1;
+    }
+    uint8_t c = input.front();
+    input.pop_front();
+    return c;
+}
+
+HardwareSerial Serial(true);
+HardwareSerial Serial1(false);
+HardwareSerial Serial2(false);
+
+// ---------------------------------------------------------------------------
+// FreeRTOS
+
+struct tskTaskControlBlock
+{
+    std::string name;
+    UBaseType_t priority;
+    BaseType_t core;
+    std::mutex m;
+    std::condition_variable cv;
+    uint32_t notify;
+};
+
+static tskTaskControlBlock mainTask{"loopTask", 1, 1};
+static thread_local tskTaskControlBlock *currentTask = &mainTask;
+struct TaskExit
+{
+};
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    hostLock().lock();
+}
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    hostLock().unlock();
+}
+BaseType_t xPortInIsrContext()
+{
+    return in_isr ? pdTRUE : pdFALSE;
+}
+BaseType_t xPortGetCoreID()
+{
+    return currentTask->core;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *createdTask, BaseType_t coreID)
+{
+    tskTaskControlBlock *task = new tskTaskControlBlock();
+    task->name = (name != NULL) ? name : "";
+    task->priority = priority;
+    task->core = (coreID == tskNO_AFFINITY) ? 0 : coreID;
+    task->notify = 0;
+    if (createdTask != NULL)
+    {
+        *createdTask = task;
+    }
+    std::thread([=]() {
+        currentTask = task;
+        try
+        {
+            code(parameters);
+        }
+        catch (TaskExit &)
+        {
+        }
+    }).detach();
+    return pdPASS;
+}
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *createdTask)
+{
+    return xTaskCreatePinnedToCore(code, name, stackDepth, parameters, priority, createdTask, tskNO_AFFINITY);
+}
+void vTaskDelete(TaskHandle_t task)
+{
+    if ((task == NULL) || (task == currentTask))
+    {
+        if (currentTask == &mainTask)
+        {
+            exit(0);
+        }
+        throw TaskExit();
+    }
+}
+void vTaskDelay(TickType_t ticks)
+{
+    delay(ticks * portTICK_PERIOD_MS);
+}
+TickType_t xTaskGetTickCount()
+{
+    return (TickType_t)millis();
+}
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return currentTask;
+}
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    return ((task != NULL) ? task : currentTask)->priority;
+}
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority)
+{
+    ((task != NULL) ? task : currentTask)->priority = priority;
+}
+void taskYIELD()
+{
+    std::this_thread::yield();
+}
+
+template <typename Pred>
+static bool waitFor(std::unique_lock<std::mutex> &lk, std::condition_variable &cv, TickType_t ticks, Pred pred)
+{
+    if (ticks == portMAX_DELAY)
+    {
+        cv.wait(lk, pred);
+        return true;
+    }
+    return cv.wait_for(lk, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), pred);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait)
+{
+    tskTaskControlBlock *task = currentTask;
+    std::unique_lock<std::mutex> lk(task->m);
+    waitFor(lk, task->cv, ticksToWait, [&] { return task->notify != 0; });
+    uint32_t value = task->notify;
+    if (value != 0)
+    {
+        task->notify = clearCountOnExit ? 0 : value - 1;
+    }
+    return value;
+}
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    std::lock_guard<std::mutex> lk(task->m);
+    task->notify++;
+    task->cv.notify_all();
+    return pdPASS;
+}
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken)
+{
+    xTaskNotifyGive(task);
+    if (higherPriorityTaskWoken != NULL)
+    {
+        *higherPriorityTaskWoken = pdTRUE;
+    }
+}
+
+// queues, semaphores and mutexes share one object, as in FreeRTOS
+struct QueueDefinition
+{
+    enum Kind
+    {
+        QUEUE,
+        SEMAPHORE,
+        MUTEX,
+        RECURSIVE_MUTEX
+    } kind;
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t count;
+    TaskHandle_t holder;
+    UBaseType_t depth;
+};
+
+static QueueDefinition *newQueue(QueueDefinition::Kind kind, UBaseType_t length, UBaseType_t itemSize, UBaseType_t count)
+{
+    QueueDefinition *q = new QueueDefinition();
+    q->kind = kind;
+    q->length = length;
+    q->itemSize = itemSize;
+    q->count = count;
+    q->holder = NULL;
+    q->depth = 0;
+    return q;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    return newQueue(QueueDefinition::QUEUE, length, itemSize, 0);
+}
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait)
+{
+    std::unique_lock<std::mutex> lk(queue->m);
+    if (!waitFor(lk, queue->cv, ticksToWait, [&] { return queue->items.size() < queue->length; }))
+    {
+        return pdFALSE;
+    }
+    const uint8_t *p = (const uint8_t *)item;
+    queue->items.emplace_back(p, p + queue->itemSize);
+    queue->cv.notify_all();
+    return pdTRUE;
+}
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higherPriorityTaskWoken)
+{
+    return xQueueSend(queue, item, 0);
+}
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticksToWait)
+{
+    std::unique_lock<std::mutex> lk(queue->m);
+    if (!waitFor(lk, queue->cv, ticksToWait, [&] { return !queue->items.empty(); }))
+    {
+        return pdFALSE;
+    }
+    memcpy(buffer, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    queue->cv.notify_all();
+    return pdTRUE;
+}
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    std::lock_guard<std::mutex> lk(queue->m);
+    return (queue->kind == QueueDefinition::QUEUE) ? queue->items.size() : queue->count;
+}
+void vQueueDelete(QueueHandle_t queue)
+{
+    delete queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return newQueue(QueueDefinition::MUTEX, 1, 0, 1);
+}
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex()
+{
+    return newQueue(QueueDefinition::RECURSIVE_MUTEX, 1, 0, 1);
+}
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return newQueue(QueueDefinition::SEMAPHORE, 1, 0, 0);
+}
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount)
+{
+    return newQueue(QueueDefinition::SEMAPHORE, maxCount, 0, initialCount);
+}
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait)
+{
+    std::unique_lock<std::mutex> lk(semaphore->m);
+    if (!waitFor(lk, semaphore->cv, ticksToWait, [&] { return semaphore->count > 0; }))
+    {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    semaphore->holder = currentTask;
+    return pdTRUE;
+}
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    std::lock_guard<std::mutex> lk(semaphore->m);
+    if (semaphore->count >= semaphore->length)
+    {
+        return pdFALSE;
+    }
+    semaphore->count++;
+    semaphore->holder = NULL;
+    semaphore->cv.notify_all();
+    return pdTRUE;
+}
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higherPriorityTaskWoken)
+{
+    return xSemaphoreGive(semaphore);
+}
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticksToWait)
+{
+    std::unique_lock<std::mutex> lk(mutex->m);
+    if (mutex->holder == currentTask)
+    {
+        mutex->depth++;
+        return pdTRUE;
+    }
+    if (!waitFor(lk, mutex->cv, ticksToWait, [&] { return mutex->holder == NULL; }))
+    {
+        return pdFALSE;
+    }
+    mutex->holder = currentTask;
+    mutex->depth = 1;
+    return pdTRUE;
+}
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex)
+{
+    std::lock_guard<std::mutex> lk(mutex->m);
+    if (mutex->holder != currentTask)
+    {
+        return pdFALSE;
+    }
+    if (--mutex->depth == 0)
+    {
+        mutex->holder = NULL;
+        mutex->cv.notify_all();
+    }
+    return pdTRUE;
+}
+TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t mutex)
+{
+    std::lock_guard<std::mutex> lk(mutex->m);
+    return mutex->holder;
+}
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    delete semaphore;
+}
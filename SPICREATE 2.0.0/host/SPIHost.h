@@ -0,0 +1,54 @@
+// Host build of SPICREATE
+//
+// SPICREATE.cpp and the sensor/flash drivers compile unchanged against the headers in
+// host/include. Every SPI transaction is executed byte by byte against the device models
+// whose chip select pin is low, and time only advances when the code waits or the bus
+// moves data, so a flight's worth of logging runs in seconds.
+#pragma once
+
+#ifndef SPIHOST_H
+#define SPIHOST_H
+#include <Arduino.h>
+#include <driver/spi_master.h>
+
+namespace spihost
+{
+    // A device on the bus. transfer() is one full-duplex byte while CS is low.
+    class DeviceModel
+    {
+    public:
+        virtual ~DeviceModel() {}
+        virtual void select() {}
+        virtual uint8_t transfer(uint8_t mosi) = 0;
+        virtual void deselect() {}
+    };
+
+    // cost of one transaction on top of the bits on the wire, in ns
+    struct Timing
+    {
+        uint64_t pollingOverhead = 3000;   // spi_device_polling_transmit
+        uint64_t interruptOverhead = 15000; // spi_device_transmit and queued transactions
+        uint64_t gpioWrite = 100;          // digitalWrite
+        // board wiring: above this clock (Hz) MISO is sampled one bit late, 0: never
+        uint32_t misoLimit = 0;
+    };
+
+    // model attached to a chip select pin (active low)
+    void attach(int csPin, DeviceModel *model);
+    void detach(int csPin);
+
+    Timing &timing();
+
+    // virtual clock
+    uint64_t nanos();
+    void advance(uint64_t ns);
+
+    // runs the handler registered with attachInterrupt() or attachInterruptArg() for pin, in ISR context
+    void raiseInterrupt(int pin);
+
+    // transactions that would have failed or hung on the target
+    // (bus held by another device, several chip selects low, ...)
+    uint32_t errors();
+} // spihost
+
+#endif
@@ -0,0 +1,139 @@
+// Host build of SPICREATE: bus traces written by SPICreate::traceDump()
+//
+// Trace::load() reads a dump (a Serial log with other output in between is fine).
+// ReplayModel answers a device's transactions with the rx bytes recorded in flight, in
+// order, and counts where the driver now sends different bytes than it did then.
+#pragma once
+
+#ifndef SPIHOST_TRACE_H
+#define SPIHOST_TRACE_H
+#include "SPIHost.h"
+#include <SPICREATE.h>
+#include <map>
+#include <vector>
+
+namespace spihost
+{
+    struct TraceEntry
+    {
+        SPICREATE::SPITraceRecord r;
+        std::vector<uint8_t> tx;
+        std::vector<uint8_t> rx;
+    };
+
+    struct Trace
+    {
+        uint32_t dropped{0};
+        std::map<int, int> cs; // device -> CS pin
+        std::vector<TraceEntry> entries;
+
+        bool load(const char *path)
+        {
+            FILE *f = fopen(path, "r");
+            if (f == NULL)
+            {
+                return false;
+            }
+            char line[1200];
+            bool ended = false;
+            while (!ended && (fgets(line, sizeof(line), f) != NULL))
+            {
+                int device, pin;
+                unsigned n;
+                if (sscanf(line, "#SPITRACE %u", &n) == 1)
+                {
+                    dropped = n;
+                }
+                else if (sscanf(line, "#SPIDEV %d %d", &device, &pin) == 2)
+                {
+                    cs[device] = pin;
+                }
+                else if (strncmp(line, "#SPIEND", 7) == 0)
+                {
+                    ended = true;
+                }
+                else if (strncmp(line, "#SPI ", 5) == 0)
+                {
+                    std::vector<uint8_t> bytes;
+                    for (const char *p = line + 5; (p[0] != '\0') && (p[1] != '\0') && (p[0] != '\n'); p += 2)
+                    {
+                        unsigned b;
+                        if (sscanf(p, "%2x", &b) != 1)
+                        {
+                            break;
+                        }
+                        bytes.push_back(b);
+                    }
+                    TraceEntry e;
+                    if (bytes.size() < sizeof(e.r))
+                    {
+                        continue;
+                    }
+                    memcpy(&e.r, bytes.data(), sizeof(e.r));
+                    if (bytes.size() != sizeof(e.r) + e.r.txStored + e.r.rxStored)
+                    {
+                        continue;
+                    }
+                    e.tx.assign(bytes.begin() + sizeof(e.r), bytes.begin() + sizeof(e.r) + e.r.txStored);
+                    e.rx.assign(bytes.begin() + sizeof(e.r) + e.r.txStored, bytes.end());
+                    entries.push_back(e);
+                }
+            }
+            fclose(f);
+            return ended;
+        }
+    };
+
+    class ReplayModel : public DeviceModel
+    {
+        std::vector<const TraceEntry *> queue;
+        size_t next{0};
+        const TraceEntry *cur{NULL};
+        size_t pos{0};
+
+    public:
+        uint32_t mismatches{0}; // transactions where the driver sent other data bytes
+        uint32_t missing{0};    // transactions after the recording ran out
+        bool mismatched{false};
+
+        ReplayModel(const Trace &trace, int device)
+        {
+            for (const TraceEntry &e : trace.entries)
+            {
+                if (e.r.device == device)
+                {
+                    queue.push_back(&e);
+                }
+            }
+        }
+        size_t remaining() { return queue.size() - next; }
+
+        void select() override
+        {
+            cur = (next < queue.size()) ? queue[next++] : NULL;
+            pos = 0;
+            mismatched = false;
+            if (cur == NULL)
+            {
+                missing++;
+            }
+        }
+        uint8_t transfer(uint8_t mosi) override
+        {
+            size_t i = pos++;
+            if ((cur == NULL) || (i < cur->r.prefix))
+            {
+                return 0xFF;
+            }
+            i -= cur->r.prefix;
+            if ((i < cur->tx.size()) && (cur->tx[i] != mosi) && !mismatched)
+            {
+                mismatched = true;
+                mismatches++;
+            }
+            return (i < cur->rx.size()) ? cur->rx[i] : 0xFF;
+        }
+    };
+} // spihost
+
+#endif
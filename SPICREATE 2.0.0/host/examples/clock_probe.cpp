@@ -0,0 +1,39 @@
+// probeClock() against the models on a board whose MISO line gets unreliable above a given
+// clock (spihost::timing().misoLimit). Every device must end up at or below the limit and
+// still read its WHO_AM_I/RDID right.
+#include <SPIHost.h>
+#include <models/RegisterModel.h>
+#include <models/ICM20948Model.h>
+#include <models/FlashModel.h>
+#include "logboard_setup.h"
+
+int main(int argc, char **argv)
+{
+    uint32_t limit = (argc > 1) ? strtoul(argv[1], NULL, 0) : 9000000;
+    spihost::timing().misoLimit = limit;
+    spihost::attach(PIN::H3LIS, spihost::newH3LIS331());
+    spihost::attach(PIN::ICM, new spihost::ICM20948Model());
+    spihost::attach(PIN::LPS, spihost::newLPS25HB());
+    spihost::attach(PIN::FLASH, new spihost::FlashModel(spihost::S25FL512S));
+
+    SensorSPI.begin(HSPI, PIN::SCK, PIN::MISO, PIN::MOSI);
+    FlashSPI.begin(VSPI);
+    H3lis331.begin(&SensorSPI, PIN::H3LIS, 1000000);
+    icm20948.begin(&SensorSPI, PIN::ICM, 1000000);
+    Lps25.begin(&SensorSPI, PIN::LPS, 1000000);
+    flash1.begin(&FlashSPI, PIN::FLASH, 1000000);
+
+    uint32_t hz[4] = {H3lis331.probeClock(), icm20948.probeClock(), Lps25.probeClock(), flash1.probeClock()};
+    const char *name[4] = {"H3LIS331", "ICM20948", "LPS25HB", "S25FL512S"};
+    uint8_t who[4] = {H3lis331.WhoAmI(), icm20948.WhoAmI(), Lps25.WhoAmI(), 0};
+    const uint8_t expect[4] = {0x32, 0xEA, 0xBD, 0};
+    int bad = 0;
+    printf("MISO limit %u Hz\n", limit);
+    for (int i = 0; i < 4; i++)
+    {
+        bool ok = (hz[i] != 0) && (hz[i] <= limit) && (who[i] == expect[i]);
+        printf("%-9s %8u Hz %s\n", name[i], hz[i], ok ? "ok" : "WRONG");
+        bad += ok ? 0 : 1;
+    }
+    return ((bad == 0) && (spihost::errors() == 0)) ? 0 : 1;
+}
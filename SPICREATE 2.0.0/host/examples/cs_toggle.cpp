@@ -0,0 +1,74 @@
+// Host check of examples/main.cpp (software vs hardware chip select) against the sensor models.
+// The host cannot tell how long a digitalWrite takes on the target, so this prints no timing.
+// It runs the sketch's measure() in each mode and checks that every Get() lowers and raises
+// the chip select of its own sensor exactly once, and never touches the others. The first
+// ICM20948 Get() after begin() also writes REG_BANK_SEL once to get back to user bank 0.
+#include <SPIHost.h>
+#include <models/RegisterModel.h>
+#include <models/ICM20948Model.h>
+#include "../../examples/main.cpp"
+
+// counts the chip select edges seen by the model behind it
+class EdgeCounter : public spihost::DeviceModel
+{
+    spihost::DeviceModel *model;
+
+public:
+    uint32_t selects{0};
+    uint32_t deselects{0};
+
+    EdgeCounter(spihost::DeviceModel *target) : model(target) {}
+    void select() override
+    {
+        selects++;
+        model->select();
+    }
+    uint8_t transfer(uint8_t mosi) override { return model->transfer(mosi); }
+    void deselect() override
+    {
+        deselects++;
+        model->deselect();
+    }
+};
+
+int main()
+{
+    EdgeCounter *cs[3] = {new EdgeCounter(spihost::newH3LIS331()), new EdgeCounter(new spihost::ICM20948Model()),
+                          new EdgeCounter(spihost::newLPS25HB())};
+    spihost::attach(PIN::H3LIS, cs[0]);
+    spihost::attach(PIN::ICM, cs[1]);
+    spihost::attach(PIN::LPS, cs[2]);
+
+    const char *name[3] = {"H3LIS331", "ICM20948", "LPS25HB"};
+    const char *modeName[2] = {"software", "hardware"};
+    const uint32_t bankSelect[3] = {0, 1, 0};
+    int bad = 0;
+    SPIC.begin(HSPI, PIN::SCK, PIN::MISO, PIN::MOSI);
+    for (int mode = 0; mode < 2; mode++)
+    {
+        SPIC.setHardwareCS(mode == 1);
+        h3lis[mode].begin(&SPIC, PIN::H3LIS);
+        icm[mode].begin(&SPIC, PIN::ICM);
+        lps[mode].begin(&SPIC, PIN::LPS);
+        for (int sensor = 0; sensor < 3; sensor++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                cs[k]->selects = 0;
+                cs[k]->deselects = 0;
+            }
+            measure(mode, sensor);
+            bool ok = true;
+            for (int k = 0; k < 3; k++)
+            {
+                uint32_t expected = (k == sensor) ? N + bankSelect[k] : 0;
+                ok = ok && (cs[k]->selects == expected) && (cs[k]->deselects == expected);
+            }
+            Serial.printf("%-8s %-9s %u Get(), CS low %u, high %u, other sensors %u %s\n", modeName[mode], name[sensor],
+                          N, cs[sensor]->selects, cs[sensor]->deselects,
+                          cs[(sensor + 1) % 3]->selects + cs[(sensor + 2) % 3]->selects, ok ? "ok" : "WRONG");
+            bad += ok ? 0 : 1;
+        }
+    }
+    return ((bad == 0) && (spihost::errors() == 0)) ? 0 : 1;
+}
@@ -0,0 +1,65 @@
+// ICM20602 read on its data-ready interrupt (beginCapture/Read) against the sensor model.
+// INT is raised when the model produces each sample (8 kHz as begin() configures it); each
+// capture must carry that sample and the time of its interrupt, with nothing dropped.
+#include <SPIHost.h>
+#include <models/RegisterModel.h>
+#include <ICM20602.h>
+
+namespace PIN
+{
+    const int SCK = 14;
+    const int MISO = 12;
+    const int MOSI = 13;
+    const int ICM = 26;
+    const int INT = 34;
+}
+
+SPICREATE::SPICreate SensorSPI;
+ICM20602 icm20602;
+
+int main(int argc, char **argv)
+{
+    int samples = (argc > 1) ? atoi(argv[1]) : 1000;
+    spihost::SensorModel *model = spihost::newICM20602();
+    spihost::attach(PIN::ICM, model);
+    SensorSPI.begin(HSPI, PIN::SCK, PIN::MISO, PIN::MOSI);
+    icm20602.begin(&SensorSPI, PIN::ICM, 8000000);
+    if (!icm20602.beginCapture(PIN::INT) || (model->reg[ICM20602Device::ICM_INT_ENABLE] != ICM20602Device::ICM_DATA_RDY_INT_EN))
+    {
+        printf("beginCapture failed\n");
+        return 1;
+    }
+
+    int bad = 0;
+    uint32_t maxLatency = 0;
+    for (int i = 0; i < samples; i++)
+    {
+        uint64_t due = model->nextSampleNs();
+        uint32_t n = model->samples + 1;
+        spihost::advance(due - spihost::nanos());
+        int64_t raised = esp_timer_get_time();
+        spihost::raiseInterrupt(PIN::INT);
+        int16_t rx[6];
+        int64_t time = 0;
+        if (!icm20602.Read(rx, &time, 100))
+        {
+            printf("sample %d: no capture\n", i);
+            return 1;
+        }
+        // accel X, Y, Z, (temperature), gyro X, Y, Z
+        const int axes[6] = {0, 1, 2, 4, 5, 6};
+        for (int k = 0; k < 6; k++)
+        {
+            int16_t v = (int16_t)((spihost::SensorModel::sampleByte(n, 2 * axes[k]) << 8) |
+                                  spihost::SensorModel::sampleByte(n, 2 * axes[k] + 1));
+            bad += (rx[k] == v) ? 0 : 1;
+        }
+        bad += (time == raised) ? 0 : 1;
+        uint32_t latency = (uint32_t)(esp_timer_get_time() - time);
+        maxLatency = (latency > maxLatency) ? latency : maxLatency;
+    }
+    SensorSPI.endCapture();
+    printf("%d samples, %d wrong, %u dropped, interrupt to data max %u us\n", samples, bad,
+           SensorSPI.capturesDropped(1), maxLatency);
+    return ((bad == 0) && (SensorSPI.capturesDropped(1) == 0) && (spihost::errors() == 0)) ? 0 : 1;
+}
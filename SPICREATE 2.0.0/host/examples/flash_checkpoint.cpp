@@ -0,0 +1,131 @@
+// Flash::restoreFlashAddress() after a reset. First logs pages through submitPage() with a
+// checkpoint every 64 pages and restarts from a second Flash, then fills the S25FL512S model
+// directly up to the whole chip: clean, with a torn last checkpoint, and with an old log in the
+// last sector instead of checkpoints, which must be left alone until clearCheckpoint().
+// Prints the time of restoreFlashAddress() next to the setFlashAddress() search on the virtual clock.
+#include <SPIHost.h>
+#include <models/FlashModel.h>
+#include <S25FL512S.h>
+
+const uint32_t EVERY = 64;
+
+SPICREATE::SPICreate FlashSPI;
+spihost::FlashModel *model;
+
+enum Damage
+{
+    CLEAN,
+    TORN,
+    FOREIGN,
+};
+
+// n log pages from PAGE_LENGTH and the checkpoints the logger would have written for them
+void fill(uint32_t pages, uint32_t checkpointAddr, Damage damage)
+{
+    std::fill(model->mem.begin(), model->mem.end(), 0xFF);
+    uint32_t entry = 0;
+    for (uint32_t p = 0; p < pages; p++)
+    {
+        uint32_t addr = PAGE_LENGTH + PAGE_LENGTH * p;
+        model->mem[addr] = (uint8_t)p;
+        model->mem[addr + 1] = (uint8_t)(p >> 8);
+        if ((damage != FOREIGN) && ((addr + PAGE_LENGTH) % (EVERY * PAGE_LENGTH) == 0))
+        {
+            uint32_t next = addr + PAGE_LENGTH;
+            for (int k = 0; k < 4; k++)
+            {
+                model->mem[checkpointAddr + entry + k] = (uint8_t)(next >> (8 * k));
+                model->mem[checkpointAddr + entry + k + 4] = (uint8_t)(~next >> (8 * k));
+                model->mem[checkpointAddr + entry + k + 8] = (uint8_t)(next >> (8 * k));
+                model->mem[checkpointAddr + entry + k + 12] = (uint8_t)(~next >> (8 * k));
+            }
+            entry += CHECKPOINT_ENTRY;
+        }
+    }
+    if (damage == TORN)
+    {
+        model->mem[checkpointAddr + entry] = 0x12;
+    }
+    if (damage == FOREIGN)
+    {
+        std::fill(model->mem.begin() + checkpointAddr, model->mem.begin() + checkpointAddr + SECTOR_SIZE, 0x33);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    model = new spihost::FlashModel(spihost::S25FL512S);
+    spihost::attach(5, model);
+    FlashSPI.begin(VSPI);
+    int bad = 0;
+
+    {
+        Flash logger;
+        logger.begin(&FlashSPI, 5, 20000000);
+        SPIFlashLatestAddress = PAGE_LENGTH;
+        logger.restoreFlashAddress();
+        alignas(4) uint8_t page[PAGE_LENGTH];
+        memset(page, 0x33, PAGE_LENGTH);
+        for (int p = 0; p < 1000; p++)
+        {
+            while (!logger.submitPage(SPIFlashLatestAddress, page))
+            {
+                delayMicroseconds(10);
+                logger.poll();
+            }
+            SPIFlashLatestAddress += PAGE_LENGTH;
+            if (SPIFlashLatestAddress % (EVERY * PAGE_LENGTH) == 0)
+            {
+                while (!logger.submitCheckpoint(SPIFlashLatestAddress))
+                {
+                    delayMicroseconds(10);
+                    logger.poll();
+                }
+            }
+        }
+        logger.wait();
+    }
+    // after the reset
+    Flash flash;
+    flash.begin(&FlashSPI, 5, 20000000);
+    {
+        uint32_t expected = SPIFlashLatestAddress;
+        SPIFlashLatestAddress = PAGE_LENGTH;
+        uint32_t found = flash.restoreFlashAddress();
+        printf("logged 1000 pages: 0x%08X %s\n", found, (found == expected) ? "ok" : "WRONG");
+        bad += (found == expected) ? 0 : 1;
+    }
+
+    const uint32_t fills[] = {0, 1, 63, 64, 65, 0x1000, 0x12345, (0x4000000 - SECTOR_SIZE) / PAGE_LENGTH - 1};
+    const char *damages[] = {"", ", torn", ", old log"};
+    for (int damage = CLEAN; damage <= FOREIGN; damage++)
+    {
+        for (uint32_t pages : fills)
+        {
+            uint32_t checkpointAddr = SPI_FLASH_MAX_ADDRESS - SECTOR_SIZE;
+            fill(pages, checkpointAddr, (Damage)damage);
+            SPIFlashLatestAddress = PAGE_LENGTH;
+            int64_t start = esp_timer_get_time();
+            uint32_t found = flash.restoreFlashAddress();
+            int64_t restoreUs = esp_timer_get_time() - start;
+            SPIFlashLatestAddress = PAGE_LENGTH;
+            start = esp_timer_get_time();
+            flash.setFlashAddress();
+            int64_t searchUs = esp_timer_get_time() - start;
+            bool ok = found == PAGE_LENGTH + PAGE_LENGTH * pages;
+            if (damage == FOREIGN)
+            {
+                // the old log stays and gets no checkpoints until the application clears the sector
+                ok = ok && (model->mem[checkpointAddr + SECTOR_SIZE - 1] == 0x33) && !flash.submitCheckpoint(found);
+                flash.clearCheckpoint();
+                ok = ok && flash.submitCheckpoint(found);
+                flash.wait();
+                ok = ok && (model->mem[checkpointAddr] == (uint8_t)found);
+            }
+            printf("%6u pages%s: 0x%08X in %lld us (search %lld us) %s\n", pages, damages[damage], found,
+                   (long long)restoreUs, (long long)searchUs, ok ? "ok" : "WRONG");
+            bad += ok ? 0 : 1;
+        }
+    }
+    return ((bad == 0) && (model->violations == 0) && (spihost::errors() == 0)) ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+// Bulk erase of the S25FL512S model with Flash::eraseAsync(). The loop keeps running every
+// 10 ms of virtual time while the chip erases (about 103 s), printing eraseProgress(), and the
+// callback must come from poll() exactly once. Then the pages written before must read 0xFF.
+#include <SPIHost.h>
+#include <models/FlashModel.h>
+#include <S25FL512S.h>
+
+SPICREATE::SPICreate FlashSPI;
+Flash flash;
+
+static void erased(void *arg)
+{
+    (*(int *)arg)++;
+}
+
+int main(int argc, char **argv)
+{
+    int pages = (argc > 1) ? atoi(argv[1]) : 64;
+    spihost::FlashModel *model = new spihost::FlashModel(spihost::S25FL512S);
+    spihost::attach(5, model);
+    FlashSPI.begin(VSPI);
+    flash.begin(&FlashSPI, 5, 20000000);
+
+    alignas(4) uint8_t page[PAGE_LENGTH];
+    memset(page, 0x5A, PAGE_LENGTH);
+    for (int p = 0; p < pages; p++)
+    {
+        flash.write(PAGE_LENGTH * p, page);
+    }
+
+    int done = 0;
+    if (!flash.eraseAsync(erased, &done) || flash.eraseAsync())
+    {
+        printf("eraseAsync failed\n");
+        return 1;
+    }
+    int64_t start = esp_timer_get_time();
+    uint32_t loops = 0;
+    int shown = -10;
+    while (flash.erasing())
+    {
+        int progress = flash.eraseProgress();
+        if (progress / 10 != shown / 10)
+        {
+            printf("%3d%% at %6.1f s\n", progress, (esp_timer_get_time() - start) / 1e6);
+            shown = progress;
+        }
+        flash.poll();
+        delay(10);
+        loops++;
+    }
+    int64_t us = esp_timer_get_time() - start;
+
+    int bad = 0;
+    for (int p = 0; p < pages; p++)
+    {
+        flash.read(PAGE_LENGTH * p, page);
+        for (int i = 0; i < PAGE_LENGTH; i++)
+        {
+            bad += (page[i] == 0xFF) ? 0 : 1;
+        }
+    }
+    printf("erased in %.1f s, %u loop cycles, callback %d, progress %d%%, %d bad bytes, %u violations\n", us / 1e6,
+           loops, done, flash.eraseProgress(), bad, model->violations);
+    return ((done == 1) && (bad == 0) && (model->violations == 0) && (spihost::errors() == 0)) ? 0 : 1;
+}
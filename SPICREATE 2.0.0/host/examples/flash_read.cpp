@@ -0,0 +1,61 @@
+// Reads the start of the S25FL512S model with each Flash::setReadMode() and compares what
+// comes back. Prints the throughput on the virtual clock, which is what a log dump gets.
+#include <SPIHost.h>
+#include <models/FlashModel.h>
+#include <S25FL512S.h>
+
+namespace PIN
+{
+    const int FLASH = 5;
+    const int WP = 22;
+    const int HD = 21;
+}
+
+SPICREATE::SPICreate FlashSPI;
+Flash flash;
+
+int main(int argc, char **argv)
+{
+    size_t bytes = (argc > 1) ? strtoul(argv[1], NULL, 0) : 0x100000;
+    spihost::FlashModel *model = new spihost::FlashModel(spihost::S25FL512S);
+    for (size_t i = 0; i < bytes; i++)
+    {
+        model->mem[i] = (uint8_t)(i * 31 + (i >> 8));
+    }
+    spihost::attach(PIN::FLASH, model);
+    FlashSPI.setQuadPins(PIN::WP, PIN::HD);
+    FlashSPI.begin(VSPI);
+    flash.begin(&FlashSPI, PIN::FLASH, 20000000);
+
+    struct
+    {
+        const char *name;
+        FlashReadMode mode;
+        uint32_t freq;
+    } runs[] = {
+        {"4READ", FLASH_READ_NORMAL, 0},
+        {"4FAST_READ", FLASH_READ_FAST, 40000000},
+        {"4QOR", FLASH_READ_QUAD, 40000000},
+    };
+    uint8_t *rx = (uint8_t *)heap_caps_malloc(bytes, MALLOC_CAP_DMA);
+    int bad = 0;
+    for (auto &run : runs)
+    {
+        if (!flash.setReadMode(run.mode, run.freq))
+        {
+            printf("%-10s setReadMode failed\n", run.name);
+            bad++;
+            continue;
+        }
+        memset(rx, 0, bytes);
+        int64_t start = esp_timer_get_time();
+        flash.read(0, rx, bytes);
+        int64_t us = esp_timer_get_time() - start;
+        bool ok = memcmp(rx, model->mem.data(), bytes) == 0;
+        printf("%-10s %zu bytes in %lld us, %.2f MB/s %s\n", run.name, bytes, (long long)us,
+               (double)bytes / ((us > 0) ? us : 1), ok ? "ok" : "WRONG");
+        bad += ok ? 0 : 1;
+    }
+    bad += (model->cr & CR1_QUAD) ? 0 : 1;
+    return ((bad == 0) && (model->violations == 0) && (spihost::errors() == 0)) ? 0 : 1;
+}
@@ -0,0 +1,40 @@
+// Flash::setFlashAddress() after a reset, against the S25FL512S model filled with n log pages.
+// Every page starts with a timestamp whose low byte is 0xFF, so a one-byte probe would stop
+// early. Prints the time each search takes on the virtual clock.
+#include <SPIHost.h>
+#include <models/FlashModel.h>
+#include <S25FL512S.h>
+
+SPICREATE::SPICreate FlashSPI;
+Flash flash;
+
+int main(int argc, char **argv)
+{
+    spihost::FlashModel *model = new spihost::FlashModel(spihost::S25FL512S);
+    spihost::attach(5, model);
+    FlashSPI.begin(VSPI);
+    flash.begin(&FlashSPI, 5, 20000000);
+
+    const uint32_t fills[] = {0, 1, 2, 0x10, 0x1000, 0x12345, 0x4000000 / PAGE_LENGTH - 1, 0x4000000 / PAGE_LENGTH};
+    uint32_t written = 0;
+    int bad = 0;
+    for (uint32_t pages : fills)
+    {
+        for (; written < pages; written++)
+        {
+            uint8_t *page = &model->mem[written * PAGE_LENGTH];
+            page[0] = 0xFF;
+            page[1] = (uint8_t)written;
+            page[2] = (uint8_t)(written >> 8);
+            page[3] = 0x80;
+        }
+        SPIFlashLatestAddress = 0;
+        int64_t start = esp_timer_get_time();
+        uint32_t found = flash.setFlashAddress();
+        int64_t us = esp_timer_get_time() - start;
+        bool ok = found == pages * PAGE_LENGTH;
+        printf("%6u pages: 0x%08X in %lld us %s\n", pages, found, (long long)us, ok ? "ok" : "WRONG");
+        bad += ok ? 0 : 1;
+    }
+    return ((bad == 0) && (model->violations == 0) && (spihost::errors() == 0)) ? 0 : 1;
+}
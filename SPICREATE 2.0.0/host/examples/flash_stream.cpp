@@ -0,0 +1,92 @@
+// Dumps the start of the S25FL512S model with Flash::stream() (one read command, CS held) and
+// with read() in PAGE_LENGTH pieces, in each read mode, and compares both with the model.
+// Prints the throughput on the virtual clock.
+#include <SPIHost.h>
+#include <models/FlashModel.h>
+#include <S25FL512S.h>
+
+namespace PIN
+{
+    const int FLASH = 5;
+    const int WP = 22;
+    const int HD = 21;
+}
+
+SPICREATE::SPICreate FlashSPI;
+Flash flash;
+
+struct Dump
+{
+    uint8_t *out;
+    size_t got;
+    size_t calls;
+};
+
+static void collect(const uint8_t *data, size_t n, void *arg)
+{
+    Dump *d = (Dump *)arg;
+    memcpy(d->out + d->got, data, n);
+    d->got += n;
+    d->calls++;
+}
+
+int main(int argc, char **argv)
+{
+    size_t bytes = (argc > 1) ? strtoul(argv[1], NULL, 0) : 0x100000;
+    // an odd start and length, so the first and last chunks are partial
+    const uint32_t start = 0x1233;
+    spihost::FlashModel *model = new spihost::FlashModel(spihost::S25FL512S);
+    for (size_t i = 0; i < start + bytes; i++)
+    {
+        model->mem[i] = (uint8_t)(i * 31 + (i >> 8));
+    }
+    spihost::attach(PIN::FLASH, model);
+    FlashSPI.setQuadPins(PIN::WP, PIN::HD);
+    FlashSPI.begin(VSPI);
+    flash.begin(&FlashSPI, PIN::FLASH, 20000000);
+
+    struct
+    {
+        const char *name;
+        FlashReadMode mode;
+        uint32_t freq;
+    } runs[] = {
+        {"4READ", FLASH_READ_NORMAL, 0},
+        {"4FAST_READ", FLASH_READ_FAST, 40000000},
+        {"4QOR", FLASH_READ_QUAD, 40000000},
+    };
+    uint8_t *rx = (uint8_t *)malloc(bytes);
+    alignas(4) uint8_t page[PAGE_LENGTH];
+    int bad = 0;
+    for (auto &run : runs)
+    {
+        if (!flash.setReadMode(run.mode, run.freq))
+        {
+            printf("%-10s setReadMode failed\n", run.name);
+            bad++;
+            continue;
+        }
+        memset(rx, 0, bytes);
+        int64_t t0 = esp_timer_get_time();
+        for (size_t done = 0; done < bytes; done += PAGE_LENGTH)
+        {
+            size_t n = (bytes - done < PAGE_LENGTH) ? bytes - done : PAGE_LENGTH;
+            flash.read(start + done, page);
+            memcpy(rx + done, page, n);
+        }
+        int64_t pagedUs = esp_timer_get_time() - t0;
+        bool pagedOk = memcmp(rx, &model->mem[start], bytes) == 0;
+
+        memset(rx, 0, bytes);
+        Dump dump = {rx, 0, 0};
+        t0 = esp_timer_get_time();
+        bool started = flash.stream(start + 1, bytes - 1, collect, &dump);
+        int64_t streamUs = esp_timer_get_time() - t0;
+        bool streamOk = started && (dump.got == bytes - 1) && (memcmp(rx, &model->mem[start + 1], bytes - 1) == 0);
+        printf("%-10s read() %.2f MB/s %s, stream() %.2f MB/s in %zu chunks %s\n", run.name,
+               (double)bytes / ((pagedUs > 0) ? pagedUs : 1), pagedOk ? "ok" : "WRONG",
+               (double)(bytes - 1) / ((streamUs > 0) ? streamUs : 1), dump.calls, streamOk ? "ok" : "WRONG");
+        bad += (pagedOk ? 0 : 1) + (streamOk ? 0 : 1);
+    }
+    return ((bad == 0) && (model->violations == 0) && (spihost::errors() == 0)) ? 0 : 1;
+}
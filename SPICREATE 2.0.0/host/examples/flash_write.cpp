@@ -0,0 +1,50 @@
+// Writes pages to the S25FL512S model as fast as submitPage() takes them, then reads them
+// back. The model counts every command that reaches the chip while it is still programming,
+// so this fails if the pipeline ever sends WREN/PP before WIP is clear.
+#include <SPIHost.h>
+#include <models/FlashModel.h>
+#include <S25FL512S.h>
+
+SPICREATE::SPICreate FlashSPI;
+Flash flash;
+
+int main(int argc, char **argv)
+{
+    int pages = (argc > 1) ? atoi(argv[1]) : 1000;
+    spihost::FlashModel *model = new spihost::FlashModel(spihost::S25FL512S);
+    spihost::attach(5, model);
+    FlashSPI.begin(VSPI);
+    flash.begin(&FlashSPI, 5, 20000000);
+
+    alignas(4) uint8_t page[PAGE_LENGTH];
+    int64_t start = esp_timer_get_time();
+    uint32_t rejected = 0;
+    for (int p = 0; p < pages; p++)
+    {
+        for (int i = 0; i < PAGE_LENGTH; i++)
+        {
+            page[i] = (uint8_t)(p + i);
+        }
+        while (!flash.submitPage(PAGE_LENGTH * (p + 1), page))
+        {
+            rejected++;
+            delayMicroseconds(10);
+            flash.poll();
+        }
+    }
+    flash.wait();
+    int64_t us = esp_timer_get_time() - start;
+
+    int bad = 0;
+    for (int p = 0; p < pages; p++)
+    {
+        flash.read(PAGE_LENGTH * (p + 1), page);
+        for (int i = 0; i < PAGE_LENGTH; i++)
+        {
+            bad += (page[i] == (uint8_t)(p + i)) ? 0 : 1;
+        }
+    }
+    printf("%d pages in %lld us (%lld us/page, tPP %u us), %u retries, %d bad bytes, %u violations\n", pages,
+           (long long)us, (long long)(us / pages), PAGE_PROGRAM_US, rejected, bad, model->violations);
+    return ((bad == 0) && (model->violations == 0) && (spihost::errors() == 0)) ? 0 : 1;
+}
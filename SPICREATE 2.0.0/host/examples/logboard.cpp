@@ -0,0 +1,100 @@
+// Host run of LogBoard67: the logging loop against device models.
+// Checks every page that reached the flash model and prints the bus statistics. The H3LIS331
+// and LPS25HB models produce samples at the rate begin() sets (1 kHz, 25 Hz): every row must
+// hold one whole sample of each, and a new H3LIS331 one most of the time.
+// Past 8192 cycles the logging reaches the sectors RoutineWork() erases in the background,
+// with the page programs suspending those erases; logging must not stop.
+// With a second argument the sensor bus is traced and dumped to that file (see trace_replay.cpp).
+#include <SPIHost.h>
+#include <models/RegisterModel.h>
+#include <models/ICM20948Model.h>
+#include <models/FlashModel.h>
+#include "logboard_setup.h"
+
+int main(int argc, char **argv)
+{
+    int cycles = (argc > 1) ? atoi(argv[1]) : 4000;
+
+    spihost::SensorModel *h3lis = spihost::newH3LIS331();
+    spihost::ICM20948Model *icm = new spihost::ICM20948Model();
+    spihost::SensorModel *lps = spihost::newLPS25HB();
+    spihost::FlashModel *flash = new spihost::FlashModel(spihost::S25FL512S);
+    spihost::attach(PIN::H3LIS, h3lis);
+    spihost::attach(PIN::ICM, icm);
+    spihost::attach(PIN::LPS, lps);
+    spihost::attach(PIN::FLASH, flash);
+    for (int i = 0; i < 12; i++)
+    {
+        icm->banks[0][0x2D + i] = 0x20 + i;
+    }
+
+    const char *tracePath = (argc > 2) ? argv[2] : NULL;
+    if (tracePath != NULL)
+    {
+        // started before the drivers' begin() so a replay sees their setup too
+        SensorSPI.traceBegin(64 * 1024 * 1024);
+    }
+    beginLogBoard();
+    SensorSPI.resetStats();
+    FlashSPI.resetStats();
+
+    uint64_t start = spihost::nanos();
+    uint64_t worst = runLogBoard(cycles);
+    uint64_t elapsed = spihost::nanos() - start;
+    if (tracePath != NULL)
+    {
+        FILE *f = fopen(tracePath, "w");
+        if (f != NULL)
+        {
+            FilePrint out(f);
+            SensorSPI.traceDump(out);
+            fclose(f);
+        }
+    }
+
+    int rows = PAGE_LENGTH / 32;
+    int pages = cycles / rows;
+    int bad = 0;
+    int repeated = 0;
+    int pressures = 0;
+    int last = -1;
+    for (int p = 0; p < pages; p++)
+    {
+        const uint8_t *page = &flash->mem[PAGE_LENGTH + PAGE_LENGTH * p];
+        for (int row = 0; row < rows; row++)
+        {
+            const uint8_t *r = page + 32 * row;
+            bool ok = true;
+            for (int i = 0; i < 6; i++)
+            {
+                ok = ok && (r[4 + i] == spihost::SensorModel::sampleByte(r[4], i)) && (r[10 + i] == 0x20 + i) &&
+                     (r[16 + i] == 0x26 + i);
+            }
+            // pressure: all zero until the first sample
+            bool pressure = (r[28] | r[29] | r[30]) != 0;
+            for (int i = 0; i < 3; i++)
+            {
+                ok = ok && (!pressure || (r[28 + i] == spihost::SensorModel::sampleByte(r[28], i)));
+            }
+            bad += ok ? 0 : 1;
+            repeated += (r[4] == last) ? 1 : 0;
+            pressures += pressure ? 1 : 0;
+            last = r[4];
+        }
+    }
+
+    Serial.printf("cycles: %d, pages: %d, bad rows: %d\n", cycles, pages, bad);
+    Serial.printf("samples: H3LIS331 %u (%d rows repeat one), LPS25HB %u (%d rows hold one)\n", h3lis->samples,
+                  repeated, lps->samples, pressures);
+    Serial.printf("virtual time: %llu us, worst RoutineWork: %llu us\n",
+                  (unsigned long long)(elapsed / 1000), (unsigned long long)(worst / 1000));
+    Serial.printf("flash: %u programs, %u erases (%u suspends), %u violations; bus errors: %u; %s\n",
+                  flash->programs, flash->erases, flash->suspends, flash->violations, spihost::errors(),
+                  logboard.full() ? "logging stopped" : "logging");
+    Serial.println("sensor bus");
+    SensorSPI.printStats();
+    Serial.println("flash bus");
+    FlashSPI.printStats();
+    bool fresh = (repeated < pages * rows / 10) && (pressures > 0);
+    return ((bad == 0) && fresh && !logboard.full() && (flash->violations == 0) && (spihost::errors() == 0)) ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+// LogBoard67 wiring shared by the host examples. Attach the models before beginLogBoard().
+#pragma once
+
+#ifndef SPIHOST_LOGBOARD_SETUP_H
+#define SPIHOST_LOGBOARD_SETUP_H
+#include <SPIHost.h>
+#include <LogBoard67.h>
+
+namespace PIN
+{
+    const int SCK = 14;
+    const int MISO = 12;
+    const int MOSI = 13;
+    const int H3LIS = 25;
+    const int ICM = 26;
+    const int LPS = 27;
+    const int FLASH = 5;
+}
+
+SPICREATE::SPICreate SensorSPI;
+SPICREATE::SPICreate FlashSPI;
+LogBoard67 logboard;
+
+void beginLogBoard()
+{
+    SensorSPI.begin(HSPI, PIN::SCK, PIN::MISO, PIN::MOSI);
+    FlashSPI.begin(VSPI);
+    LogBoard67Config config;
+    config.sensorSPI = &SensorSPI;
+    config.flashSPI = &FlashSPI;
+    config.h3lisCS = PIN::H3LIS;
+    config.icmCS = PIN::ICM;
+    config.lpsCS = PIN::LPS;
+    config.flashCS = PIN::FLASH;
+    config.probeClocks = true;
+    logboard.begin(config);
+    SPIFlashLatestAddress = PAGE_LENGTH;
+    logboard.restoreAddress();
+    logboard.eraseAhead(0x80000);
+}
+
+// runs RoutineWork() 1 ms apart, returns the longest call in ns
+uint64_t runLogBoard(int cycles)
+{
+    uint64_t worst = 0;
+    for (int i = 0; i < cycles; i++)
+    {
+        uint64_t t0 = spihost::nanos();
+        logboard.RoutineWork();
+        uint64_t took = spihost::nanos() - t0;
+        worst = (took > worst) ? took : worst;
+        delay(1);
+    }
+    flash1.wait();
+    return worst;
+}
+
+// Print into a file, for traceDump()
+class FilePrint : public Print
+{
+    FILE *f;
+
+public:
+    FilePrint(FILE *file) : f(file) {}
+    size_t write(uint8_t c) override { return fputc(c, f) == EOF ? 0 : 1; }
+};
+
+#endif
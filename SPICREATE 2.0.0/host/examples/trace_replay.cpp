@@ -0,0 +1,145 @@
+// Reads a SPICreate::traceDump() of the LogBoard67 sensor bus, prints timing per device
+// and for the bus, then runs the LogBoard67 code again with every sensor answered from
+// the trace. The flash model ends up with what the board logged, and every transaction
+// where today's drivers send other bytes than the flight build did is counted.
+#include <SPIHost.h>
+#include <Trace.h>
+#include <models/FlashModel.h>
+#include <algorithm>
+#include "logboard_setup.h"
+
+struct Interval
+{
+    uint32_t n{0};
+    uint64_t sum{0};
+    uint32_t min{0xFFFFFFFF};
+    uint32_t max{0};
+    void add(uint32_t v)
+    {
+        n++;
+        sum += v;
+        min = (v < min) ? v : min;
+        max = (v > max) ? v : max;
+    }
+    void print(const char *name)
+    {
+        if (n == 0)
+        {
+            printf("  %-9s -\n", name);
+            return;
+        }
+        printf("  %-9s min %u avg %llu max %u us\n", name, min, (unsigned long long)(sum / n), max);
+    }
+};
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: trace_replay <dump>\n");
+        return 2;
+    }
+    spihost::Trace trace;
+    if (!trace.load(argv[1]))
+    {
+        fprintf(stderr, "%s: no complete trace dump\n", argv[1]);
+        return 2;
+    }
+    printf("%zu transactions, %u dropped\n", trace.entries.size(), trace.dropped);
+
+    // timing
+    for (auto &d : trace.cs)
+    {
+        Interval duration, period;
+        uint32_t last = 0;
+        bool first = true;
+        uint64_t bytes = 0;
+        for (const spihost::TraceEntry &e : trace.entries)
+        {
+            if (e.r.device != d.first)
+            {
+                continue;
+            }
+            bytes += e.r.prefix + e.r.length;
+            duration.add(e.r.duration);
+            if (!first)
+            {
+                period.add(e.r.time - last);
+            }
+            first = false;
+            last = e.r.time;
+        }
+        printf("dev%d cs%d: %u transactions, %llu bytes\n", d.first, d.second, duration.n, (unsigned long long)bytes);
+        duration.print("duration");
+        period.print("period");
+    }
+    // gaps between the end of one transaction and the start of the next, in start order;
+    // negative gaps are transactions that waited for the bus
+    std::vector<const spihost::TraceEntry *> order;
+    for (const spihost::TraceEntry &e : trace.entries)
+    {
+        order.push_back(&e);
+    }
+    std::stable_sort(order.begin(), order.end(), [](const spihost::TraceEntry *a, const spihost::TraceEntry *b) {
+        return (int32_t)(a->r.time - b->r.time) < 0;
+    });
+    Interval gap;
+    uint32_t overlaps = 0;
+    for (size_t i = 1; i < order.size(); i++)
+    {
+        const SPICREATE::SPITraceRecord &a = order[i - 1]->r;
+        int32_t g = (int32_t)(order[i]->r.time - (a.time + a.duration));
+        if ((g < 0) && !(a.flags & SPICREATE::SPI_TRACE_QUEUED))
+        {
+            overlaps++;
+        }
+        gap.add((g < 0) ? 0 : g);
+    }
+    printf("bus:\n");
+    gap.print("gap");
+    printf("  overlaps  %u\n", overlaps);
+
+    if (trace.dropped != 0)
+    {
+        printf("trace ring overflowed, the start is missing: no replay\n");
+        return 0;
+    }
+
+    // replay
+    std::map<int, spihost::ReplayModel *> replay;
+    for (auto &d : trace.cs)
+    {
+        replay[d.first] = new spihost::ReplayModel(trace, d.first);
+        spihost::attach(d.second, replay[d.first]);
+    }
+    spihost::FlashModel *flash = new spihost::FlashModel(spihost::S25FL512S);
+    spihost::attach(PIN::FLASH, flash);
+    beginLogBoard();
+    // one RoutineWork per recorded H3LIS331 sample
+    spihost::ReplayModel *h3lis = NULL;
+    for (auto &d : trace.cs)
+    {
+        h3lis = (d.second == PIN::H3LIS) ? replay[d.first] : h3lis;
+    }
+    int cycles = 0;
+    while ((h3lis != NULL) && (h3lis->remaining() > 0))
+    {
+        runLogBoard(1);
+        cycles++;
+    }
+    printf("replayed %d cycles, %u pages\n", cycles, flash->programs);
+    uint32_t mismatches = 0;
+    for (auto &r : replay)
+    {
+        printf("dev%d: %u mismatches, %u past the end, %zu unused\n", r.first, r.second->mismatches, r.second->missing,
+               r.second->remaining());
+        mismatches += r.second->mismatches + r.second->missing;
+    }
+    for (int row = 0; (row < 4) && (row < cycles); row++)
+    {
+        const uint8_t *r = &flash->mem[PAGE_LENGTH + 32 * row];
+        printf("row %d: t=%u H3LIS %d %d %d\n", row, r[0] | r[1] << 8 | r[2] << 16 | (uint32_t)r[3] << 24,
+               (int16_t)(r[4] | r[5] << 8), (int16_t)(r[6] | r[7] << 8), (int16_t)(r[8] | r[9] << 8));
+    }
+    return (mismatches == 0) ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+// Host build of SPICREATE: the parts of the arduino-esp32 core used by these libraries.
+// micros()/millis()/delay() run on the virtual clock of SPIHost.
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <deque>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <freertos/queue.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#define LOW 0x0
+#define HIGH 0x1
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define HSPI 2
+#define VSPI 3
+#define SPI_MODE0 0
+#define SPI_MODE1 1
+#define SPI_MODE2 2
+#define SPI_MODE3 3
+
+static const uint8_t SS = 5;
+static const uint8_t MOSI = 23;
+static const uint8_t MISO = 19;
+static const uint8_t SCK = 18;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+typedef void (*voidFuncPtrArg)(void *);
+void attachInterruptArg(uint8_t pin, voidFuncPtrArg handler, void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+#define digitalPinToInterrupt(p) (p)
+
+unsigned long micros();
+unsigned long millis();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); }
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    size_t print(const char *str) { return write(str); }
+    size_t print(const std::string &str) { return write(str.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int n) { return printf("%d", n); }
+    size_t print(unsigned int n) { return printf("%u", n); }
+    size_t print(long n) { return printf("%ld", n); }
+    size_t print(unsigned long n) { return printf("%lu", n); }
+    size_t print(double n) { return printf("%.2f", n); }
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(T value) { return print(value) + println(); }
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+};
+
+// Serial prints to stdout. Everything written is also kept in output, and bytes
+// pushed with inject() are what read() returns.
+class HardwareSerial : public Stream
+{
+    bool echo;
+
+public:
+    std::string output;
+    std::deque<uint8_t> input;
+
+    HardwareSerial(bool echoToStdout) : echo(echoToStdout) {}
+    void begin(unsigned long baud, uint32_t config = 0, int8_t rxPin = -1, int8_t txPin = -1) {}
+    void end() {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    int available() override { return (int)input.size(); }
+    int read() override;
+    void inject(const char *text) { input.insert(input.end(), text, text + strlen(text)); }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
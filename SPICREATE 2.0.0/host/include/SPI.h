@@ -0,0 +1,3 @@
+// Host build of SPICREATE: the Arduino SPI class is not used by the libraries
+#pragma once
+#include <Arduino.h>
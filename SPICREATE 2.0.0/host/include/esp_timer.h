@@ -0,0 +1,6 @@
+// Host build of SPICREATE: subset of ESP-IDF esp_timer.h
+#pragma once
+#include <stdint.h>
+
+// microseconds of virtual time since start
+int64_t esp_timer_get_time();
@@ -0,0 +1,37 @@
+// Host build of SPICREATE: subset of FreeRTOS as shipped with arduino-esp32.
+// Tasks run as threads; blocking waits use real time, ticks are 1 ms.
+#pragma once
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define configMAX_PRIORITIES 25
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+typedef struct
+{
+    uint32_t owner;
+    uint32_t count;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0, 0}
+
+// all critical sections share one host lock
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+#define portENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux) vPortExitCritical(mux)
+
+BaseType_t xPortInIsrContext();
+BaseType_t xPortGetCoreID();
+#define portYIELD_FROM_ISR(...) ((void)0)
@@ -0,0 +1,18 @@
+// Host build of SPICREATE: FreeRTOS semaphores and mutexes
+#pragma once
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex();
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *higherPriorityTaskWoken);
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t ticksToWait);
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex);
+TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t mutex);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
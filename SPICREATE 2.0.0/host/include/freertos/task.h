@@ -0,0 +1,23 @@
+// Host build of SPICREATE: FreeRTOS tasks and notifications
+#pragma once
+#include <freertos/FreeRTOS.h>
+
+typedef struct tskTaskControlBlock *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameters,
+                                   UBaseType_t priority, TaskHandle_t *createdTask, BaseType_t coreID);
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *createdTask);
+// vTaskDelete(NULL) ends the calling task; other tasks cannot be killed on the host
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+void vTaskPrioritySet(TaskHandle_t task, UBaseType_t priority);
+void taskYIELD();
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticksToWait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higherPriorityTaskWoken);
@@ -0,0 +1,256 @@
+// Host build of SPICREATE: Spansion/Cypress S25FL NOR flash
+//
+// Program and erase take effect when CS goes high and keep WIP set for the datasheet
+// time on the virtual clock. Commands sent while busy or without WREN are ignored like
+// on the chip and counted in violations. A sector erase can be suspended (ERS) to program
+// other sectors and resumed (ERR) with the rest of its time left.
+#pragma once
+
+#ifndef SPIHOST_FLASH_MODEL_H
+#define SPIHOST_FLASH_MODEL_H
+#include "../SPIHost.h"
+#include <vector>
+
+namespace spihost
+{
+    struct FlashGeometry
+    {
+        uint32_t size;
+        uint8_t id[3];
+        uint32_t pageSize;
+        uint32_t sectorSize;    // SE / 4SE
+        uint32_t subsectorSize; // P4E / 4P4E, 0 if the part has none
+        uint64_t pageProgramNs;
+        uint64_t sectorEraseNs;
+        uint64_t subsectorEraseNs;
+        uint64_t bulkEraseNs;
+    };
+
+    static const FlashGeometry S25FL127S = {0x1000000, {0x01, 0x20, 0x18}, 256, 0x10000, 0x1000, 250000, 130000000, 130000000, 33000000000ULL};
+    static const FlashGeometry S25FL512S = {0x4000000, {0x01, 0x02, 0x20}, 512, 0x40000, 0, 340000, 520000000, 0, 103000000000ULL};
+
+    class FlashModel : public DeviceModel
+    {
+        enum Op
+        {
+            NONE,
+            READ,
+            PROGRAM,
+            ERASE,
+            WRITE_REGISTERS
+        };
+        FlashGeometry geo;
+        uint8_t cmd{0};
+        int count{0};
+        int addrBytes{0};
+        int dummyBytes{0};
+        uint32_t addr{0};
+        Op op{NONE};
+        uint32_t eraseSize{0};
+        std::vector<uint8_t> page;
+        bool wel{false};
+        uint8_t sr{0}; // block protection bits, as written with WRR
+        uint64_t busyUntil{0};
+        // a sector erase is running (busy) or suspended with eraseLeft to go
+        bool eraseBusy{false};
+        bool suspended{false};
+        uint64_t eraseLeft{0};
+        uint32_t suspendedBase{0};
+        uint32_t suspendedSize{0};
+
+        static const uint64_t WRITE_REGISTERS_NS = 140000000; // WRR, typical
+        static const uint64_t ERASE_SUSPEND_NS = 45000;        // tSL, max
+        bool busy() { return nanos() < busyUntil; }
+        void violation(const char *what)
+        {
+            violations++;
+            fprintf(stderr, "[flash] %s (cmd 0x%02X)\n", what, cmd);
+        }
+        void start(Op o, int bytes, int dummy, uint32_t erase = 0)
+        {
+            op = o;
+            addrBytes = bytes;
+            dummyBytes = dummy;
+            eraseSize = erase;
+        }
+
+    public:
+        std::vector<uint8_t> mem;
+        uint32_t violations{0};
+        uint32_t programs{0};
+        uint32_t erases{0};
+        uint32_t suspends{0};
+        uint8_t cr{0}; // configuration register, bit 1 QUAD (non-volatile on the chip)
+
+        FlashModel(const FlashGeometry &g) : geo(g), mem(g.size, 0xFF) {}
+
+        void select() override
+        {
+            count = 0;
+            op = NONE;
+            addr = 0;
+            page.clear();
+        }
+        uint8_t transfer(uint8_t mosi) override
+        {
+            int n = count++ - 1;
+            if (n < 0)
+            {
+                cmd = mosi;
+                if ((cmd == 0x75) && eraseBusy && !suspended)
+                {
+                    // ERS: WIP clears after tSL, ignored once the erase has finished
+                    if (busy())
+                    {
+                        eraseLeft = busyUntil - nanos();
+                        busyUntil = nanos() + ERASE_SUSPEND_NS;
+                        suspended = true;
+                        suspends++;
+                    }
+                    eraseBusy = false;
+                    cmd = 0;
+                    return 0xFF;
+                }
+                if (busy() && (cmd != 0x05))
+                {
+                    violation("command while busy");
+                    cmd = 0;
+                    return 0xFF;
+                }
+                switch (cmd)
+                {
+                case 0x06: wel = true; break;
+                case 0x04: wel = false; break;
+                case 0x03: start(READ, 3, 0); break;
+                case 0x13: start(READ, 4, 0); break;
+                case 0x0B: start(READ, 3, 1); break;
+                case 0x0C: start(READ, 4, 1); break;
+                case 0x6C:
+                    if (!(cr & 0x02))
+                    {
+                        violation("quad read with QUAD clear, IO2/IO3 are WP#/HOLD#");
+                    }
+                    start(READ, 4, 1);
+                    break;
+                case 0x01: start(WRITE_REGISTERS, 0, 0); break;
+                case 0x02: start(PROGRAM, 3, 0); break;
+                case 0x12: start(PROGRAM, 4, 0); break;
+                case 0xD8: start(ERASE, 3, 0, geo.sectorSize); break;
+                case 0xDC: start(ERASE, 4, 0, geo.sectorSize); break;
+                case 0x20: start(ERASE, 3, 0, geo.subsectorSize); break;
+                case 0x21: start(ERASE, 4, 0, geo.subsectorSize); break;
+                case 0x60:
+                case 0xC7: start(ERASE, 0, 0, geo.size); break;
+                case 0x7A:
+                    if (suspended)
+                    {
+                        busyUntil = nanos() + eraseLeft;
+                        suspended = false;
+                        eraseBusy = true;
+                    }
+                    break;
+                }
+                return 0xFF;
+            }
+            if (cmd == 0x05)
+            {
+                return (busy() ? 0x01 : 0x00) | (wel ? 0x02 : 0x00) | sr;
+            }
+            if (cmd == 0x35)
+            {
+                return cr;
+            }
+            if (cmd == 0x9F)
+            {
+                return (n < 3) ? geo.id[n] : 0xFF;
+            }
+            if (n < addrBytes)
+            {
+                addr = (addr << 8) | mosi;
+                return 0xFF;
+            }
+            if (n < addrBytes + dummyBytes)
+            {
+                return 0xFF;
+            }
+            if (op == READ)
+            {
+                uint8_t miso = mem[addr % geo.size];
+                addr = (addr + 1) % geo.size;
+                return miso;
+            }
+            if ((op == PROGRAM) || (op == WRITE_REGISTERS))
+            {
+                page.push_back(mosi);
+            }
+            return 0xFF;
+        }
+        void deselect() override
+        {
+            if ((op != PROGRAM) && (op != ERASE) && (op != WRITE_REGISTERS))
+            {
+                return;
+            }
+            if (!wel)
+            {
+                violation("program/erase without WREN");
+                return;
+            }
+            // the chip runs WRR only if CS rises right after the 8th or 16th data bit
+            if ((op == WRITE_REGISTERS) && (page.size() != 1) && (page.size() != 2))
+            {
+                violation("WRR without exactly 1 or 2 data bytes, ignored");
+                return;
+            }
+            if (suspended && (op != PROGRAM))
+            {
+                violation("erase or WRR while an erase is suspended");
+                return;
+            }
+            if (suspended && ((addr % geo.size) - suspendedBase < suspendedSize))
+            {
+                violation("program into the suspended erase sector");
+                return;
+            }
+            wel = false;
+            eraseBusy = false;
+            if (op == WRITE_REGISTERS)
+            {
+                sr = (page.size() > 0) ? (page[0] & 0x9C) : sr;
+                cr = (page.size() > 1) ? page[1] : cr;
+                busyUntil = nanos() + WRITE_REGISTERS_NS;
+                return;
+            }
+            if (op == PROGRAM)
+            {
+                if (page.size() > geo.pageSize)
+                {
+                    violation("more than one page sent, start of page overwritten");
+                }
+                uint32_t base = addr & ~(geo.pageSize - 1);
+                for (size_t i = 0; i < page.size(); i++)
+                {
+                    uint32_t a = base + ((addr + i) & (geo.pageSize - 1));
+                    mem[a % geo.size] &= page[i]; // NOR can only clear bits
+                }
+                programs++;
+                busyUntil = nanos() + geo.pageProgramNs;
+                return;
+            }
+            if (eraseSize == 0)
+            {
+                violation("erase size not supported by this part");
+                return;
+            }
+            uint32_t base = (addr % geo.size) & ~(eraseSize - 1);
+            std::fill(mem.begin() + base, mem.begin() + base + eraseSize, 0xFF);
+            erases++;
+            eraseBusy = (eraseSize != geo.size);
+            suspendedBase = base;
+            suspendedSize = eraseSize;
+            busyUntil = nanos() + ((eraseSize == geo.size) ? geo.bulkEraseNs : ((eraseSize == geo.sectorSize) ? geo.sectorEraseNs : geo.subsectorEraseNs));
+        }
+    };
+} // spihost
+
+#endif
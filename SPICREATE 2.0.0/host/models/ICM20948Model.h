@@ -0,0 +1,80 @@
+// Host build of SPICREATE: ICM-20948 with the AK09916 magnetometer behind its I2C master
+//
+// Four register banks selected through 0x7F. Writing SLV4_CTRL (bank 3) with bit 7 runs one
+// I2C transfer to the magnetometer at once; SLV0 with bit 7 set mirrors len magnetometer
+// registers into EXT_SLV_SENS_DATA (bank 0, 0x3B).
+#pragma once
+
+#ifndef SPIHOST_ICM20948_MODEL_H
+#define SPIHOST_ICM20948_MODEL_H
+#include "RegisterModel.h"
+
+namespace spihost
+{
+    class ICM20948Model : public RegisterModel
+    {
+        uint8_t bank{0};
+
+    protected:
+        uint8_t read(uint8_t addr) override
+        {
+            if (addr == 0x7F)
+            {
+                return bank << 4;
+            }
+            if ((bank == 0) && (addr >= 0x3B) && (addr < 0x3B + 24))
+            {
+                uint8_t ctrl = banks[3][0x05];
+                if ((ctrl & 0x80) && (addr - 0x3B < (ctrl & 0x0F)))
+                {
+                    return mag[(banks[3][0x04] + addr - 0x3B) & 0x7F];
+                }
+            }
+            return banks[bank][addr];
+        }
+        void write(uint8_t addr, uint8_t value) override
+        {
+            if (addr == 0x7F)
+            {
+                bank = (value >> 4) & 3;
+                return;
+            }
+            banks[bank][addr] = value;
+            if ((bank == 3) && (addr == 0x15) && (value & 0x80))
+            {
+                slv4();
+            }
+        }
+        void slv4()
+        {
+            uint8_t target = banks[3][0x13];
+            uint8_t r = banks[3][0x14];
+            if ((target & 0x7F) == 0x0C)
+            {
+                if (target & 0x80)
+                {
+                    banks[3][0x17] = mag[r & 0x7F];
+                }
+                else
+                {
+                    mag[r & 0x7F] = banks[3][0x16];
+                }
+            }
+            banks[3][0x15] &= 0x7F;
+            banks[0][0x17] |= 0x40; // I2C_PERIPH4_DONE
+        }
+
+    public:
+        uint8_t banks[4][128] = {};
+        uint8_t mag[128] = {};
+
+        ICM20948Model() : RegisterModel(0x00, 0xEA)
+        {
+            banks[0][0x00] = 0xEA;
+            mag[0x00] = 0x48;
+            mag[0x01] = 0x09;
+        }
+    };
+} // spihost
+
+#endif
@@ -0,0 +1,332 @@
+// Host build of SPICREATE: sensor with 8-bit register map
+//
+// First byte is the address, bit 7 set means read. The address moves on after every
+// data byte when incrementBit is 0 (ICM family) or when the master set incrementBit in
+// the address byte (ST: 0x40).
+#pragma once
+
+#ifndef SPIHOST_REGISTER_MODEL_H
+#define SPIHOST_REGISTER_MODEL_H
+#include "../SPIHost.h"
+#include <string.h>
+
+namespace spihost
+{
+    class RegisterModel : public DeviceModel
+    {
+    protected:
+        uint8_t incrementBit;
+        uint8_t addressMask;
+        int phase{0};
+        bool reading{false};
+        bool increment{false};
+        uint8_t address{0};
+
+        virtual uint8_t read(uint8_t addr) { return reg[addr]; }
+        virtual void write(uint8_t addr, uint8_t value) { reg[addr] = value; }
+
+    public:
+        uint8_t reg[128] = {};
+        uint32_t reads{0};
+        uint32_t writes{0};
+
+        RegisterModel(uint8_t whoAmIAddress, uint8_t whoAmI, uint8_t incrementBit = 0)
+            : incrementBit(incrementBit), addressMask((incrementBit != 0) ? (0x7F & ~incrementBit) : 0x7F)
+        {
+            reg[whoAmIAddress] = whoAmI;
+        }
+        void select() override
+        {
+            phase = 0;
+        }
+        uint8_t transfer(uint8_t mosi) override
+        {
+            if (phase == 0)
+            {
+                phase = 1;
+                reading = (mosi & 0x80) != 0;
+                increment = (incrementBit == 0) || ((mosi & incrementBit) != 0);
+                address = mosi & addressMask;
+                return 0xFF;
+            }
+            uint8_t miso = 0xFF;
+            if (reading)
+            {
+                miso = read(address);
+                reads++;
+            }
+            else
+            {
+                write(address, mosi);
+                writes++;
+            }
+            if (increment)
+            {
+                address = (address + 1) & 0x7F;
+            }
+            return miso;
+        }
+    };
+
+    // Sensor with an output data rate. While its configuration registers turn it on, a new
+    // sample lands in the data registers every periodNs() of virtual time and sets the
+    // data-ready bits of the status register; one that arrives before the last was read also
+    // sets the overrun bits. Time is looked at when CS goes low, so a burst read never mixes
+    // two samples. Byte i of sample n is sampleByte(n, i), so a reader can tell which sample
+    // it got and whether the bytes belong together. Until the first sample they read 0.
+    class SensorModel : public RegisterModel
+    {
+    protected:
+        uint8_t whoAmIAddress;
+        uint8_t dataAddress;
+        uint8_t dataLength;
+        uint8_t statusAddress;
+        uint8_t readyBits;
+        uint8_t overrunBits;
+        bool clearOnStatusRead; // InvenSense: reading INT_STATUS clears it; ST: reading the data does
+        uint8_t defaults[128] = {};
+        uint64_t period{0};
+        uint64_t start{0};
+        uint64_t ticks{0};
+
+        // time between samples in the current configuration, 0 while no data is produced
+        virtual uint64_t periodNs() = 0;
+        // bits that act on a write (reset, one-shot, ...)
+        virtual void control(uint8_t addr, uint8_t value) {}
+
+        uint8_t read(uint8_t addr) override
+        {
+            uint8_t value = reg[addr];
+            bool data = (addr >= dataAddress) && (addr < dataAddress + dataLength);
+            if (clearOnStatusRead ? (addr == statusAddress) : data)
+            {
+                reg[statusAddress] &= ~(readyBits | overrunBits);
+            }
+            return value;
+        }
+        void write(uint8_t addr, uint8_t value) override
+        {
+            bool data = (addr >= dataAddress) && (addr < dataAddress + dataLength);
+            if (data || (addr == statusAddress) || (addr == whoAmIAddress))
+            {
+                return; // read only
+            }
+            reg[addr] = value;
+            control(addr, value);
+            update();
+        }
+        // the register map as after power-on
+        void reset()
+        {
+            memcpy(reg, defaults, sizeof(reg));
+            period = 0;
+            update();
+        }
+        void publish(uint64_t n)
+        {
+            samples += n;
+            for (int i = 0; i < dataLength; i++)
+            {
+                reg[dataAddress + i] = sampleByte(samples, i);
+            }
+            bool unread = (reg[statusAddress] & readyBits) != 0;
+            reg[statusAddress] |= readyBits | (((n > 1) || unread) ? overrunBits : 0);
+        }
+        void update()
+        {
+            uint64_t p = periodNs();
+            if (p != period)
+            {
+                // a new rate starts counting from now
+                period = p;
+                start = nanos();
+                ticks = 0;
+                return;
+            }
+            if (period == 0)
+            {
+                return;
+            }
+            uint64_t n = (nanos() - start) / period;
+            if (n > ticks)
+            {
+                publish(n - ticks);
+                ticks = n;
+            }
+        }
+
+    public:
+        // samples produced so far; the data registers hold the last of them
+        uint32_t samples{0};
+
+        SensorModel(uint8_t whoAmIAddress, uint8_t whoAmI, uint8_t incrementBit, uint8_t dataAddress,
+                    uint8_t dataLength, uint8_t statusAddress, uint8_t readyBits, uint8_t overrunBits,
+                    bool clearOnStatusRead)
+            : RegisterModel(whoAmIAddress, whoAmI, incrementBit), whoAmIAddress(whoAmIAddress),
+              dataAddress(dataAddress), dataLength(dataLength), statusAddress(statusAddress), readyBits(readyBits),
+              overrunBits(overrunBits), clearOnStatusRead(clearOnStatusRead)
+        {
+            defaults[whoAmIAddress] = whoAmI;
+        }
+        static uint8_t sampleByte(uint32_t n, int i)
+        {
+            return (uint8_t)(n + 0x10 * i);
+        }
+        void select() override
+        {
+            RegisterModel::select();
+            update();
+        }
+        // virtual time the next sample arrives at, 0 while none will
+        uint64_t nextSampleNs()
+        {
+            update();
+            return (period != 0) ? start + (ticks + 1) * period : 0;
+        }
+    };
+
+    // H3LIS331DL: CTRL_REG1 sets the rate (PM and DR bits, any axis enabled). BOOT in CTRL_REG2
+    // clears itself; the chip has no register reset. Reading OUT_X_L..OUT_Z_H clears STATUS_REG.
+    class H3LIS331Model : public SensorModel
+    {
+    protected:
+        uint64_t periodNs() override
+        {
+            static const uint64_t normal[4] = {20000000, 10000000, 2500000, 1000000};
+            static const uint64_t lowPower[8] = {0, 0, 2000000000, 1000000000, 500000000, 200000000, 100000000, 0};
+            uint8_t ctrl1 = reg[0x20];
+            uint8_t pm = ctrl1 >> 5;
+            if ((ctrl1 & 0x07) == 0)
+            {
+                return 0;
+            }
+            return (pm == 1) ? normal[(ctrl1 >> 3) & 3] : lowPower[pm];
+        }
+        void control(uint8_t addr, uint8_t value) override
+        {
+            if (addr == 0x21)
+            {
+                reg[0x21] &= 0x7F; // BOOT
+            }
+        }
+
+    public:
+        H3LIS331Model() : SensorModel(0x0F, 0x32, 0x40, 0x28, 6, 0x27, 0x0F, 0xF0, false)
+        {
+            defaults[0x20] = 0x07;
+            reset();
+        }
+    };
+
+    // LPS25HB: PD and ODR in CTRL_REG1 set the rate; with ODR 0, ONE_SHOT in CTRL_REG2 takes one
+    // sample. SWRESET in CTRL_REG2 restores the register map. Pressure and temperature are the
+    // data (PRESS_OUT_XL..TEMP_OUT_H); reading them clears STATUS_REG.
+    class LPS25HBModel : public SensorModel
+    {
+    protected:
+        uint64_t periodNs() override
+        {
+            static const uint64_t rate[8] = {0, 1000000000, 142857143, 80000000, 40000000, 0, 0, 0};
+            uint8_t ctrl1 = reg[0x20];
+            return (ctrl1 & 0x80) ? rate[(ctrl1 >> 4) & 7] : 0;
+        }
+        void control(uint8_t addr, uint8_t value) override
+        {
+            if (addr != 0x21)
+            {
+                return;
+            }
+            if (value & 0x04) // SWRESET
+            {
+                reset();
+                return;
+            }
+            reg[0x21] &= ~0x81; // BOOT, ONE_SHOT
+            if ((value & 0x01) && (reg[0x20] & 0x80) && (periodNs() == 0))
+            {
+                publish(1);
+            }
+        }
+
+    public:
+        LPS25HBModel() : SensorModel(0x0F, 0xBD, 0x40, 0x28, 5, 0x27, 0x03, 0x30, false)
+        {
+            defaults[0x10] = 0x05; // RES_CONF
+            reset();
+        }
+    };
+
+    // ICM-20602: on while PWR_MGMT_1 SLEEP is clear and PWR_MGMT_2 leaves an axis on. Sample
+    // rate 8 kHz (DLPF_CFG 0 or 7) or 1 kHz, divided by 1 + SMPLRT_DIV. DEVICE_RESET in
+    // PWR_MGMT_1 restores the register map; reading INT_STATUS clears DATA_RDY_INT.
+    class ICM20602Model : public SensorModel
+    {
+    protected:
+        uint64_t periodNs() override
+        {
+            if ((reg[0x6B] & 0x40) || ((reg[0x6C] & 0x3F) == 0x3F))
+            {
+                return 0;
+            }
+            uint8_t dlpf = reg[0x1A] & 7;
+            uint64_t internal = ((dlpf == 0) || (dlpf == 7)) ? 125000 : 1000000;
+            return internal * (1 + reg[0x19]);
+        }
+        void control(uint8_t addr, uint8_t value) override
+        {
+            if ((addr == 0x6B) && (value & 0x80))
+            {
+                reset();
+            }
+        }
+
+    public:
+        ICM20602Model() : SensorModel(0x75, 0x12, 0, 0x3B, 14, 0x3A, 0x01, 0, true)
+        {
+            defaults[0x6B] = 0x41;
+            reset();
+        }
+    };
+
+    // ICM-42688-P (user bank 0): on while PWR_MGMT0 turns the accelerometer or gyro on, at the
+    // ODR of ACCEL_CONFIG0 (or GYRO_CONFIG0 with the accelerometer off). SOFT_RESET_CONFIG in
+    // DEVICE_CONFIG restores the register map; reading INT_STATUS clears DATA_RDY_INT.
+    class ICM42688Model : public SensorModel
+    {
+    protected:
+        uint64_t periodNs() override
+        {
+            static const uint64_t odr[16] = {0,        31250,    62500,     125000,    250000,    500000,
+                                             1000000,  5000000,  10000000,  20000000,  40000000,  80000000,
+                                             160000000, 320000000, 640000000, 2000000};
+            uint8_t pwr = reg[0x4E];
+            if ((pwr & 0x0F) == 0)
+            {
+                return 0;
+            }
+            return odr[((pwr & 0x03) ? reg[0x50] : reg[0x4F]) & 0x0F];
+        }
+        void control(uint8_t addr, uint8_t value) override
+        {
+            if ((addr == 0x11) && (value & 0x01))
+            {
+                reset();
+            }
+        }
+
+    public:
+        ICM42688Model() : SensorModel(0x75, 0x47, 0, 0x1D, 14, 0x2D, 0x08, 0, true)
+        {
+            defaults[0x4F] = 0x06;
+            defaults[0x50] = 0x06;
+            reset();
+        }
+    };
+
+    inline SensorModel *newH3LIS331() { return new H3LIS331Model(); }
+    inline SensorModel *newLPS25HB() { return new LPS25HBModel(); }
+    inline SensorModel *newICM20602() { return new ICM20602Model(); }
+    inline SensorModel *newICM42688() { return new ICM42688Model(); }
+} // spihost
+
+#endif
@@ -0,0 +1,146 @@
+#pragma once
+
+#ifndef SPIBUDGET_H
+#define SPIBUDGET_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Compile-time bus budget. A board lists what runs on each bus,
+//
+//     constexpr SPICREATE::SPILoad sensorBus[] = {
+//         SPICREATE::SPILoad(8000000, H3LIS331Device::Data::length + 1, 1000),
+//         SPICREATE::SPILoad(8000000, ICM20948Device::Data::length + 1, 1000),
+//     };
+//     static_assert(SPICREATE::spiUtilization(sensorBus) <= 500000, "sensor bus above 50%");
+//
+// so a change of rates, clocks or devices that no longer fits fails the build instead of the
+// flight. SPI_BUDGET_WARN takes the same arguments and only warns, for a softer limit below the
+// hard one. Everything is C++11 constexpr (one return statement, recursion instead of loops);
+// each recursion walks the list once, carrying its result so far in the last argument.
+namespace arduino
+{
+    namespace esp32
+    {
+        namespace spi
+        {
+            namespace dma
+            {
+                const uint32_t SPI_APB_CLOCK = 80000000;
+                // fixed cost per transaction on top of the bits: transfer() polls up to 32 bytes
+                // and goes through the interrupt above that (same figures as the host build)
+                const uint32_t SPI_POLL_OVERHEAD_NS = 3000;
+                const uint32_t SPI_INTERRUPT_OVERHEAD_NS = 15000;
+                const uint32_t SPI_POLL_BYTES = 32;
+
+                // The clock IDF runs at for a requested one: 80 MHz / n, rounded down.
+                constexpr uint32_t spiActualClock(uint32_t hz)
+                {
+                    return (hz >= SPI_APB_CLOCK) ? SPI_APB_CLOCK : SPI_APB_CLOCK / ((SPI_APB_CLOCK + hz - 1) / hz);
+                }
+
+                constexpr uint32_t spiMinClock(uint32_t a, uint32_t b)
+                {
+                    return (a < b) ? a : b;
+                }
+
+                // One transaction repeated rateHz times a second. bytes counts everything on the
+                // wire: command, address and data. overheadNs 0 picks polling or interrupt by size.
+                struct SPILoad
+                {
+                    uint32_t clockHz;
+                    uint32_t bytes;
+                    uint32_t rateHz;
+                    uint32_t overheadNs;
+
+                    constexpr SPILoad(uint32_t clock, uint32_t n, uint32_t rate, uint32_t overhead = 0)
+                        : clockHz(spiActualClock(clock)), bytes(n), rateHz(rate),
+                          overheadNs((overhead != 0) ? overhead
+                                                     : ((n <= SPI_POLL_BYTES) ? SPI_POLL_OVERHEAD_NS : SPI_INTERRUPT_OVERHEAD_NS))
+                    {
+                    }
+                };
+
+                // bus time of one transaction
+                constexpr uint64_t spiTransferNs(const SPILoad &load)
+                {
+                    return (uint64_t)load.bytes * 8 * 1000000000ULL / load.clockHz + load.overheadNs;
+                }
+
+                // share of the bus in use, parts per million
+                template <size_t N>
+                constexpr uint64_t spiUtilization(const SPILoad (&loads)[N], size_t i = 0)
+                {
+                    return (i >= N) ? 0 : spiTransferNs(loads[i]) * loads[i].rateHz / 1000 + spiUtilization(loads, i + 1);
+                }
+
+                // longest transaction other than loads[skip]
+                template <size_t N>
+                constexpr uint64_t spiLongestOtherNs(const SPILoad (&loads)[N], size_t skip, size_t i = 0,
+                                                     uint64_t longest = 0)
+                {
+                    return (i >= N) ? longest
+                                    : spiLongestOtherNs(loads, skip, i + 1,
+                                                        ((i != skip) && (spiTransferNs(loads[i]) > longest))
+                                                            ? spiTransferNs(loads[i])
+                                                            : longest);
+                }
+
+                // From asking for the bus to having the data: a transaction that has started is never
+                // preempted, so loads[k] can find the longest of the others in progress first.
+                // Assumes the reading task has the highest priority among the bus users.
+                template <size_t N>
+                constexpr uint64_t spiWorstLatencyNs(const SPILoad (&loads)[N], size_t k)
+                {
+                    return spiLongestOtherNs(loads, k) + spiTransferNs(loads[k]);
+                }
+
+                // the worst of spiWorstLatencyNs(loads, k) over k >= i and worst
+                template <size_t N>
+                constexpr uint64_t spiWorstLatencyFrom(const SPILoad (&loads)[N], size_t i, uint64_t worst = 0)
+                {
+                    return (i >= N) ? worst
+                                    : spiWorstLatencyFrom(loads, i + 1,
+                                                          (spiWorstLatencyNs(loads, i) > worst)
+                                                              ? spiWorstLatencyNs(loads, i)
+                                                              : worst);
+                }
+
+                template <size_t N>
+                constexpr uint64_t spiWorstLatencyNs(const SPILoad (&loads)[N])
+                {
+                    return spiWorstLatencyFrom(loads, 0);
+                }
+
+                // Share of the time a flash is busy programming, parts per million. Above 1000000
+                // the pages come faster than the chip writes them.
+                constexpr uint64_t spiFlashUtilization(uint32_t pagesPerSecond, uint64_t pageProgramNs)
+                {
+                    return pagesPerSecond * pageProgramNs / 1000;
+                }
+
+                template <bool>
+                struct SPIBudgetCondition
+                {
+                };
+            } // dma
+        }     // spi
+    }         // esp32
+} // arduino
+
+// static_assert that only warns: when cond is false, the build goes on with msg as a warning
+// (-Wdeprecated-declarations). Usable at namespace, class or block scope, once per line.
+#define SPI_BUDGET_CAT2(a, b) a##b
+#define SPI_BUDGET_CAT(a, b) SPI_BUDGET_CAT2(a, b)
+#define SPI_BUDGET_WARN(cond, msg)                                                 \
+    struct SPI_BUDGET_CAT(SPIBudgetWarn, __LINE__)                                 \
+    {                                                                              \
+        template <bool holds>                                                      \
+        using Condition = arduino::esp32::spi::dma::SPIBudgetCondition<holds>;     \
+        static char check(Condition<true>);                                        \
+        __attribute__((deprecated(msg))) static char check(Condition<false>);      \
+        enum                                                                       \
+        {                                                                          \
+            value = sizeof(check(Condition<(cond)>()))                             \
+        };                                                                         \
+    }
+#endif
@@ -2,20 +2,55 @@
 #include "SPICREATE.h" // 2.0.0
 void csSet(spi_transaction_t *t)
 {
-    digitalWrite((int)t->user, HIGH);
+    // left low while the device is held (holdCS)
+    if (((intptr_t)t->user & SPI_CS_HOLD) == 0)
+    {
+        digitalWrite((int)(intptr_t)t->user, HIGH);
+    }
     return;
 }
 void csReset(spi_transaction_t *t)
 {
-    digitalWrite((int)t->user, LOW);
+    digitalWrite((int)((intptr_t)t->user & ~SPI_CS_HOLD), LOW);
     return;
 }
 SPICREATE_BEGIN
 
+// bits on the wire, command, address and dummy phases included
+static uint32_t transactionBits(spi_transaction_t *transaction)
+{
+    uint32_t bits = transaction->length;
+    if (transaction->flags & SPI_TRANS_VARIABLE_CMD)
+    {
+        bits += ((spi_transaction_ext_t *)transaction)->command_bits;
+    }
+    if (transaction->flags & SPI_TRANS_VARIABLE_ADDR)
+    {
+        bits += ((spi_transaction_ext_t *)transaction)->address_bits;
+    }
+    if (transaction->flags & SPI_TRANS_VARIABLE_DUMMY)
+    {
+        bits += ((spi_transaction_ext_t *)transaction)->dummy_bits;
+    }
+    return bits;
+}
+static inline unsigned long statStamp()
+{
+#if SPICREATE_STATS
+    return micros();
+#else
+    return 0;
+#endif
+}
+
 bool SPICreate::begin(uint8_t spi_bus, int8_t sck, int8_t miso, int8_t mosi, uint32_t f)
 {
 
     frequency = f;
+    if (busLock == NULL)
+    {
+        busLock = xSemaphoreCreateRecursiveMutex();
+    }
     if ((sck == -1) && (miso == -1) && (mosi == -1))
     {
         bus_cfg.sclk_io_num = (spi_bus == VSPI) ? SCK : 14;
@@ -30,6 +65,10 @@ bool SPICreate::begin(uint8_t spi_bus, int8_t sck, int8_t miso, int8_t mosi, uin
     }
 
     bus_cfg.max_transfer_sz = max_size;
+    // 0 would claim GPIO0
+    bus_cfg.quadwp_io_num = quad_wp;
+    bus_cfg.quadhd_io_num = quad_hd;
+    bus_cfg.flags = quadPins() ? SPICOMMON_BUSFLAG_QUAD : 0;
 
     if ((mode != SPI_MODE1) && (mode != SPI_MODE3))
     {
@@ -55,9 +94,27 @@ bool SPICreate::begin(uint8_t spi_bus, int8_t sck, int8_t miso, int8_t mosi, uin
 
     return true;
 }
+void SPICreate::setQuadPins(int8_t wp, int8_t hd)
+{
+    quad_wp = wp;
+    quad_hd = hd;
+}
+bool SPICreate::quadPins()
+{
+    return (quad_wp >= 0) && (quad_hd >= 0);
+}
 bool SPICreate::end()
 {
+    endCapture();
+    lock();
+    for (int i = 0; i < slotNum; i++)
+    {
+        heap_caps_free(slot_buffer[i]);
+        slot_buffer[i] = NULL;
+    }
+    slotNum = 0;
     esp_err_t e = spi_bus_free(host);
+    unlock();
     if (e != ESP_OK)
     {
         // printf("[ERROR] SPI bus free failed : %d\n", e);
@@ -66,27 +123,267 @@ bool SPICreate::end()
 
     return true;
 }
-int SPICreate::addDevice(spi_device_interface_config_t *if_cfg, int cs)
+bool SPICreate::beginCapture(UBaseType_t priority, BaseType_t core, uint32_t stackSize)
 {
+    if (captureHandle != NULL)
+    {
+        return true;
+    }
+    captureDone = xSemaphoreCreateBinary();
+    captureStop = false;
+    capturePending = 0;
+    if ((captureDone == NULL) ||
+        (xTaskCreatePinnedToCore(captureTask, "SPICapture", stackSize, this, priority, &captureHandle, core) != pdPASS))
+    {
+        if (captureDone != NULL)
+        {
+            vSemaphoreDelete(captureDone);
+            captureDone = NULL;
+        }
+        captureHandle = NULL;
+        return false;
+    }
+    return true;
+}
+void SPICreate::endCapture()
+{
+    if (captureHandle == NULL)
+    {
+        return;
+    }
+    for (int i = 1; i < 10; i++)
+    {
+        if ((captures[i] != NULL) && (capturePin[i] >= 0))
+        {
+            detachInterrupt(capturePin[i]);
+        }
+    }
+    captureStop = true;
+    xTaskNotifyGive(captureHandle);
+    xSemaphoreTake(captureDone, portMAX_DELAY);
+    vSemaphoreDelete(captureDone);
+    captureDone = NULL;
+    captureHandle = NULL;
+    for (int i = 0; i < 10; i++)
+    {
+        if (captures[i] != NULL)
+        {
+            vQueueDelete(captures[i]);
+            captures[i] = NULL;
+        }
+    }
+}
+bool SPICreate::captureOn(int deviceHandle, int slot, int pin, int mode, int depth)
+{
+    if ((captureHandle == NULL) || (deviceHandle <= 0) || (deviceHandle > deviceNum) || (slot < 0) ||
+        (slot >= slotNum) || (captures[deviceHandle] != NULL))
+    {
+        return false;
+    }
+    captures[deviceHandle] = xQueueCreate(depth, sizeof(SPICapture));
+    if (captures[deviceHandle] == NULL)
+    {
+        return false;
+    }
+    captureSlot[deviceHandle] = slot;
+    capturePin[deviceHandle] = pin;
+    captureDropped[deviceHandle] = 0;
+    captureSource[deviceHandle] = {this, deviceHandle};
+    if (pin >= 0)
+    {
+        pinMode(pin, INPUT);
+        attachInterruptArg(pin, captureISR, &captureSource[deviceHandle], mode);
+    }
+    return true;
+}
+void IRAM_ATTR SPICreate::captureISR(void *arg)
+{
+    SPICaptureSource *source = (SPICaptureSource *)arg;
+    source->spi->captureFromISR(source->deviceHandle);
+}
+void IRAM_ATTR SPICreate::captureFromISR(int deviceHandle)
+{
+    if (captureHandle == NULL)
+    {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL_ISR(&captureMux);
+    if (capturePending & (1u << deviceHandle))
+    {
+        captureDropped[deviceHandle]++; // the previous sample was never read; keep its time
+    }
+    else
+    {
+        capturePending |= 1u << deviceHandle;
+        captureTime[deviceHandle] = now;
+    }
+    portEXIT_CRITICAL_ISR(&captureMux);
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(captureHandle, &woken);
+    if (woken)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+void SPICreate::captureTask(void *arg)
+{
+    SPICreate *spi = (SPICreate *)arg;
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (spi->captureStop)
+        {
+            break;
+        }
+        int64_t time[10];
+        portENTER_CRITICAL(&spi->captureMux);
+        uint32_t pending = spi->capturePending;
+        spi->capturePending = 0;
+        for (int i = 1; i < 10; i++)
+        {
+            time[i] = spi->captureTime[i];
+        }
+        portEXIT_CRITICAL(&spi->captureMux);
+        for (int i = 1; i < 10; i++)
+        {
+            if ((pending & (1u << i)) && (spi->captures[i] != NULL))
+            {
+                spi->capture(i, time[i]);
+            }
+        }
+    }
+    xSemaphoreGive(spi->captureDone);
+    vTaskDelete(NULL);
+}
+void SPICreate::capture(int deviceHandle, int64_t time)
+{
+    int slot = captureSlot[deviceHandle];
+    spi_transaction_t *t = &slot_transaction[slot].base;
+    SPICapture c;
+    c.time = time;
+    int64_t woke = esp_timer_get_time();
+    lock();
+    c.wait = (uint32_t)(esp_timer_get_time() - woke);
+    pollTransmit(t, deviceHandle);
+    c.latency = (uint32_t)(esp_timer_get_time() - time);
+    c.length = ((int)t->length / 8 < SPI_CAPTURE_BYTES) ? t->length / 8 : SPI_CAPTURE_BYTES;
+    memcpy(c.data, slot_buffer[slot], c.length);
+    unlock();
+    if (xQueueSend(captures[deviceHandle], &c, 0) != pdTRUE)
+    {
+        captureDropped[deviceHandle]++;
+    }
+}
+bool SPICreate::getCapture(int deviceHandle, SPICapture *out, TickType_t ticksToWait)
+{
+    if (captures[deviceHandle] == NULL)
+    {
+        return false;
+    }
+    return xQueueReceive(captures[deviceHandle], out, ticksToWait) == pdTRUE;
+}
+uint32_t SPICreate::capturesDropped(int deviceHandle)
+{
+    return captureDropped[deviceHandle];
+}
+bool SPICreate::lock(TickType_t ticksToWait)
+{
+    if (busLock == NULL)
+    {
+        return true;
+    }
+    return xSemaphoreTakeRecursive(busLock, ticksToWait) == pdTRUE;
+}
+void SPICreate::unlock()
+{
+    if (busLock != NULL)
+    {
+        xSemaphoreGiveRecursive(busLock);
+    }
+}
+int SPICreate::addDevice(spi_device_interface_config_t *if_cfg, int cs, bool softwareCS)
+{
+    lock();
     deviceNum++;
-    CSs[deviceNum] = cs;
-    pinMode(cs, OUTPUT);
-    digitalWrite(cs, HIGH);
     if (deviceNum > 9)
     {
+        unlock();
         return 0;
     }
+    CSs[deviceNum] = cs;
+    queued[deviceNum] = 0;
+    queuedHead[deviceNum] = 0;
+    stat[deviceNum] = {};
+    autoIncrement[deviceNum] = false;
+    incrementBit[deviceNum] = 0;
+    readBit[deviceNum] = 0x80;
+    priority[deviceNum] = SPI_PRIORITY_NORMAL;
+    hwCS[deviceNum] = hardware_cs && !softwareCS && (hwCSNum < 3);
+    if (hwCS[deviceNum])
+    {
+        if_cfg->spics_io_num = cs;
+        if_cfg->cs_ena_pretrans = ((cs_pretrans > 1) && !(if_cfg->flags & SPI_DEVICE_HALFDUPLEX)) ? 1 : cs_pretrans;
+        if_cfg->cs_ena_posttrans = cs_posttrans;
+        if (if_cfg->pre_cb == csReset)
+        {
+            if_cfg->pre_cb = NULL;
+        }
+        if (if_cfg->post_cb == csSet)
+        {
+            if_cfg->post_cb = NULL;
+        }
+    }
+    else
+    {
+        pinMode(cs, OUTPUT);
+        digitalWrite(cs, HIGH);
+    }
+    // at least setQueueSize(), at most what queuedAt can track
+    if (if_cfg->queue_size < queue_size)
+    {
+        if_cfg->queue_size = queue_size;
+    }
+    if (if_cfg->queue_size > SPI_QUEUE_MAX)
+    {
+        if_cfg->queue_size = SPI_QUEUE_MAX;
+    }
+    devcfg[deviceNum] = *if_cfg;
     esp_err_t e = spi_bus_add_device(host, if_cfg, &handle[deviceNum]);
+    int added = deviceNum;
+    if ((e == ESP_OK) && hwCS[added])
+    {
+        hwCSNum++;
+    }
+    unlock();
     if (e != ESP_OK)
     {
         return 0;
     }
-    return deviceNum;
+    return added;
+}
+void SPICreate::setHardwareCS(bool enable, uint8_t pretrans, uint8_t posttrans)
+{
+    hardware_cs = enable;
+    cs_pretrans = pretrans;
+    cs_posttrans = posttrans;
 }
 
 bool SPICreate::rmDevice(int deviceHandle)
 {
+    lock();
+    drain(deviceHandle);
+    if (burstDevice == deviceHandle)
+    {
+        releaseBus();
+    }
     esp_err_t e = spi_bus_remove_device(handle[deviceHandle]);
+    if ((e == ESP_OK) && hwCS[deviceHandle])
+    {
+        hwCS[deviceHandle] = false;
+        hwCSNum--;
+    }
+    unlock();
     if (e != ESP_OK)
     {
         // printf("[ERROR] SPI bus remove device failed : %d\n", e);
@@ -94,14 +391,142 @@ bool SPICreate::rmDevice(int deviceHandle)
     }
     return true;
 }
+bool SPICreate::setClock(int deviceHandle, uint32_t hz)
+{
+    if ((deviceHandle < 1) || (deviceHandle > deviceNum))
+    {
+        return false;
+    }
+    lock();
+    drain(deviceHandle);
+    if (burstDevice == deviceHandle)
+    {
+        releaseBus();
+    }
+    spi_device_interface_config_t cfg = devcfg[deviceHandle];
+    cfg.clock_speed_hz = hz;
+    bool changed = false;
+    if (spi_bus_remove_device(handle[deviceHandle]) == ESP_OK)
+    {
+        changed = spi_bus_add_device(host, &cfg, &handle[deviceHandle]) == ESP_OK;
+        if (changed)
+        {
+            devcfg[deviceHandle] = cfg;
+        }
+        else
+        {
+            spi_bus_add_device(host, &devcfg[deviceHandle], &handle[deviceHandle]);
+        }
+    }
+    unlock();
+    return changed;
+}
+uint32_t SPICreate::deviceClock(int deviceHandle)
+{
+    if ((deviceHandle < 1) || (deviceHandle > deviceNum))
+    {
+        return 0;
+    }
+    return devcfg[deviceHandle].clock_speed_hz;
+}
+void SPICreate::probeRead(const spi_transaction_ext_t *probes, int n, uint8_t *out, int deviceHandle)
+{
+    // each probe lands word aligned, so IDF needs no bounce buffer
+    alignas(4) uint8_t rx[64];
+    for (int i = 0; i < n; i++)
+    {
+        spi_transaction_ext_t t = probes[i];
+        int size = (t.base.length + 7) / 8;
+        t.base.flags &= ~(SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA);
+        t.base.tx_buffer = NULL;
+        t.base.rx_buffer = rx;
+        t.base.rxlength = 0;
+        t.base.user = csUser(deviceHandle);
+        transfer((spi_transaction_t *)&t, deviceHandle);
+        memcpy(out, rx, size);
+        out += size;
+    }
+}
+uint32_t SPICreate::probeClock(int deviceHandle, const spi_transaction_ext_t *probes, int n, uint32_t maxHz,
+                               uint32_t minHz, int tries, int marginPercent)
+{
+    const uint32_t apb = 80000000;
+    int total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        total += (probes[i].base.length + 7) / 8;
+    }
+    if ((deviceHandle < 1) || (deviceHandle > deviceNum) || (n < 1) || (total > 64) || (minHz == 0))
+    {
+        return 0;
+    }
+    uint8_t reference[64];
+    uint8_t answer[64];
+    lock();
+    uint32_t original = devcfg[deviceHandle].clock_speed_hz;
+    uint32_t good = 0; // fastest step that matched every time
+    bool failed = false;
+    for (uint32_t div = apb / minHz; (div >= 2) && !failed; div--)
+    {
+        uint32_t hz = apb / div;
+        if (hz > maxHz)
+        {
+            break;
+        }
+        // a clock IDF refuses (e.g. above the full-duplex GPIO matrix limit) is the end of
+        // the range, not a read error: keep the last good step without the margin
+        if (!setClock(deviceHandle, hz))
+        {
+            break;
+        }
+        if (good == 0)
+        {
+            probeRead(probes, n, reference, deviceHandle);
+            bool floating = true;
+            for (int i = 1; i < total; i++)
+            {
+                floating = floating && (reference[i] == reference[0]);
+            }
+            if (floating && ((reference[0] == 0x00) || (reference[0] == 0xFF)))
+            {
+                break;
+            }
+        }
+        for (int k = 0; (k < tries) && !failed; k++)
+        {
+            probeRead(probes, n, answer, deviceHandle);
+            failed = memcmp(answer, reference, total) != 0;
+        }
+        if (!failed)
+        {
+            good = hz;
+        }
+    }
+    uint32_t hz = good;
+    if (failed && (good != 0))
+    {
+        // the fastest step at or below the margin; the first step is the floor
+        uint32_t limit = (uint64_t)good * (100 - marginPercent) / 100;
+        uint32_t div = (apb + limit - 1) / ((limit > 0) ? limit : 1);
+        hz = apb / ((div < 2) ? 2 : div);
+        hz = (hz < apb / (apb / minHz)) ? apb / (apb / minHz) : hz;
+    }
+    if ((hz == 0) || !setClock(deviceHandle, hz))
+    {
+        setClock(deviceHandle, original);
+        hz = 0;
+    }
+    unlock();
+    return hz;
+}
 void SPICreate::sendCmd(uint8_t cmd, int deviceHandle)
 {
     spi_transaction_t comm = {};
     comm.flags = SPI_TRANS_USE_TXDATA;
     comm.length = 8;
     comm.tx_data[0] = cmd;
-    comm.user = (void *)CSs[deviceHandle];
-    pollTransmit(&comm, deviceHandle);
+    comm.user = csUser(deviceHandle);
+    transfer(&comm, deviceHandle);
 }
 uint8_t SPICreate::readByte(uint8_t addr, int deviceHandle)
 {
@@ -109,8 +534,8 @@ uint8_t SPICreate::readByte(uint8_t addr, int deviceHandle)
     comm.flags = SPI_TRANS_USE_RXDATA | SPI_TRANS_USE_TXDATA;
     comm.tx_data[0] = addr;
     comm.length = 16;
-    comm.user = (void *)CSs[deviceHandle];
-    pollTransmit(&comm, deviceHandle);
+    comm.user = csUser(deviceHandle);
+    transfer(&comm, deviceHandle);
     return comm.rx_data[1];
 }
 void SPICreate::setReg(uint8_t addr, uint8_t data, int deviceHandle)
@@ -120,7 +545,126 @@ void SPICreate::setReg(uint8_t addr, uint8_t data, int deviceHandle)
     comm.length = 16;
     comm.tx_data[0] = addr;
     comm.tx_data[1] = data;
-    transmit(&comm, deviceHandle);
+    comm.user = csUser(deviceHandle);
+    transfer(&comm, deviceHandle);
+}
+void SPICreate::setRegs(const uint8_t (*regs)[2], int n, int deviceHandle, bool dropRepeats)
+{
+    lock();
+    int16_t written[128];
+    for (int i = 0; i < 128; i++)
+    {
+        written[i] = -1;
+    }
+    uint8_t burst[32];
+    uint8_t start = 0;
+    int length = 0;
+    for (int i = 0; i < n; i++)
+    {
+        uint8_t addr = regs[i][0] & 0x7F;
+        uint8_t data = regs[i][1];
+        if (dropRepeats && (written[addr] == data))
+        {
+            continue;
+        }
+        written[addr] = data;
+        if ((length > 0) && autoIncrement[deviceHandle] && (addr == start + length) && (length < 32))
+        {
+            burst[length++] = data;
+            continue;
+        }
+        if (length > 0)
+        {
+            setRegs(start, burst, length, deviceHandle);
+        }
+        start = addr;
+        burst[0] = data;
+        length = 1;
+    }
+    if (length > 0)
+    {
+        setRegs(start, burst, length, deviceHandle);
+    }
+    unlock();
+}
+void SPICreate::setRegs(uint8_t addr, const uint8_t *data, int n, int deviceHandle)
+{
+    if ((n == 1) || !autoIncrement[deviceHandle])
+    {
+        for (int i = 0; i < n; i++)
+        {
+            setReg(addr + i, data[i], deviceHandle);
+        }
+        return;
+    }
+    while (n > 32)
+    {
+        setRegs(addr, data, 32, deviceHandle);
+        addr += 32;
+        data += 32;
+        n -= 32;
+    }
+    uint8_t tx[33];
+    tx[0] = addr | incrementBit[deviceHandle];
+    memcpy(&tx[1], data, n);
+    spi_transaction_t comm = {};
+    comm.length = (n + 1) * 8;
+    if (n < 4)
+    {
+        comm.flags = SPI_TRANS_USE_TXDATA;
+        memcpy(comm.tx_data, tx, n + 1);
+    }
+    else
+    {
+        comm.tx_buffer = tx;
+    }
+    comm.user = csUser(deviceHandle);
+    transfer(&comm, deviceHandle);
+}
+void SPICreate::setAutoIncrement(int deviceHandle, uint8_t bit)
+{
+    autoIncrement[deviceHandle] = true;
+    incrementBit[deviceHandle] = bit;
+}
+void SPICreate::setReadBit(int deviceHandle, uint8_t bit)
+{
+    readBit[deviceHandle] = bit;
+}
+void SPICreate::readRegs(uint8_t addr, uint8_t *data, int n, int deviceHandle)
+{
+    if ((n == 1) || !autoIncrement[deviceHandle])
+    {
+        for (int i = 0; i < n; i++)
+        {
+            data[i] = readByte((addr + i) | readBit[deviceHandle], deviceHandle);
+        }
+        return;
+    }
+    // same chunking as the write side; 32 bytes covers every sensor's output block
+    while (n > 32)
+    {
+        readRegs(addr, data, 32, deviceHandle);
+        addr += 32;
+        data += 32;
+        n -= 32;
+    }
+    alignas(4) uint8_t rx[32];
+    spi_transaction_ext_t comm = {};
+    comm.base.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+    comm.base.cmd = addr | readBit[deviceHandle] | incrementBit[deviceHandle];
+    comm.command_bits = 8;
+    comm.base.length = n * 8;
+    if (n <= 4)
+    {
+        comm.base.flags |= SPI_TRANS_USE_RXDATA;
+    }
+    else
+    {
+        comm.base.rx_buffer = rx;
+    }
+    comm.base.user = csUser(deviceHandle);
+    transfer((spi_transaction_t *)&comm, deviceHandle);
+    memcpy(data, (n <= 4) ? comm.base.rx_data : rx, n);
 }
 void SPICreate::transmit(uint8_t *tx, int size, int deviceHandle)
 {
@@ -138,14 +682,504 @@ void SPICreate::transmit(uint8_t *tx, uint8_t *rx, int size, int deviceHandle)
 
 void SPICreate::transmit(spi_transaction_t *transaction, int deviceHandle)
 {
-    digitalWrite(CSs[deviceHandle], LOW);
-    esp_err_t e = spi_device_transmit(handle[deviceHandle], transaction);
-    digitalWrite(CSs[deviceHandle], HIGH);
+    transaction->user = csUser(deviceHandle); // for csReset/csSet
+    unsigned long t0 = statStamp();
+    lock();
+    drain(deviceHandle);
+    holdBus(deviceHandle);
+    unsigned long t1 = statStamp();
+    spi_device_transmit(handle[deviceHandle], transaction);
+    record(deviceHandle, transaction, t1 - t0, statStamp() - t1);
+    unlock();
     return;
 }
 void SPICreate::pollTransmit(spi_transaction_t *transaction, int deviceHandle)
 {
+    transaction->user = csUser(deviceHandle); // for csReset/csSet
+    unsigned long t0 = statStamp();
+    lock();
+    drain(deviceHandle);
+    holdBus(deviceHandle);
+    unsigned long t1 = statStamp();
     spi_device_polling_transmit(handle[deviceHandle], transaction);
+    record(deviceHandle, transaction, t1 - t0, statStamp() - t1, SPI_TRACE_POLLED);
+    unlock();
     return;
 }
+void SPICreate::transfer(spi_transaction_t *transaction, int deviceHandle)
+{
+    if (chunkable(transaction, deviceHandle))
+    {
+        transferChunked(transaction, deviceHandle);
+        return;
+    }
+    if ((int)transactionBits(transaction) <= poll_threshold * 8)
+    {
+        pollTransmit(transaction, deviceHandle);
+    }
+    else
+    {
+        transmit(transaction, deviceHandle);
+    }
+}
+void SPICreate::setPollThreshold(int bytes)
+{
+    poll_threshold = (bytes < 0) ? 0 : bytes;
+}
+int SPICreate::pollThreshold()
+{
+    return poll_threshold;
+}
+void SPICreate::setPriority(int deviceHandle, SPIPriority p, int chunkSize)
+{
+    priority[deviceHandle] = p;
+    // keep every chunk's part of the receive buffer word aligned for the DMA
+    chunk_size[deviceHandle] = (chunkSize < 4) ? 4 : (chunkSize & ~3);
+}
+SPIPriority SPICreate::devicePriority(int deviceHandle)
+{
+    return priority[deviceHandle];
+}
+int SPICreate::chunkSize(int deviceHandle)
+{
+    return chunk_size[deviceHandle];
+}
+bool SPICreate::chunkable(spi_transaction_t *transaction, int deviceHandle)
+{
+    if (priority[deviceHandle] != SPI_PRIORITY_LOW)
+    {
+        return false;
+    }
+    // the address must move on with the data, and nothing may be sent in the data phase
+    if (!(transaction->flags & SPI_TRANS_VARIABLE_ADDR) || (((spi_transaction_ext_t *)transaction)->address_bits == 0) ||
+        (transaction->flags & SPI_TRANS_USE_RXDATA) ||
+        (transaction->tx_buffer != NULL) || (transaction->rx_buffer == NULL))
+    {
+        return false;
+    }
+    if ((transaction->rxlength != 0) && (transaction->rxlength != transaction->length))
+    {
+        return false;
+    }
+    if (((transaction->length % 8) != 0) || (transaction->length <= (size_t)chunk_size[deviceHandle] * 8))
+    {
+        return false;
+    }
+    // giving the lock up between chunks is only possible when we are its only holder
+    return xSemaphoreGetMutexHolder(busLock) != xTaskGetCurrentTaskHandle();
+}
+void SPICreate::transferChunked(spi_transaction_t *transaction, int deviceHandle)
+{
+    spi_transaction_ext_t part = *(spi_transaction_ext_t *)transaction;
+    uint8_t *rx = (uint8_t *)transaction->rx_buffer;
+    size_t total = transaction->length / 8;
+    size_t n;
+    for (size_t done = 0; done < total; done += n)
+    {
+        n = total - done;
+        if (n > (size_t)chunk_size[deviceHandle])
+        {
+            n = chunk_size[deviceHandle];
+        }
+        part.base.addr = transaction->addr + done;
+        part.base.length = n * 8;
+        part.base.rxlength = 0;
+        part.base.rx_buffer = rx + done;
+        // each chunk takes and gives the lock itself; a waiting sensor read runs in between
+        if ((int)transactionBits(&part.base) <= poll_threshold * 8)
+        {
+            pollTransmit(&part.base, deviceHandle);
+        }
+        else
+        {
+            transmit(&part.base, deviceHandle);
+        }
+    }
+}
+
+void SPICreate::setQueueSize(int size)
+{
+    // queuedAt keeps the timestamps of up to SPI_QUEUE_MAX outstanding transactions
+    queue_size = (size < 1) ? 1 : ((size > SPI_QUEUE_MAX) ? SPI_QUEUE_MAX : size);
+}
+bool SPICreate::queueTransmit(spi_transaction_t *transaction, int deviceHandle, TickType_t ticksToWait)
+{
+    // CS is driven by csReset/csSet, so the pin has to travel with the transaction
+    transaction->user = csUser(deviceHandle);
+    unsigned long t0 = statStamp();
+    lock();
+    holdBus(deviceHandle);
+    unsigned long t1 = statStamp();
+    esp_err_t e = spi_device_queue_trans(handle[deviceHandle], transaction, ticksToWait);
+    if (e == ESP_OK)
+    {
+        queuedAt[deviceHandle][(queuedHead[deviceHandle] + queued[deviceHandle]) & (SPI_QUEUE_MAX - 1)] = t1;
+        queued[deviceHandle]++;
+        stat[deviceHandle].waitTime += t1 - t0;
+    }
+    unlock();
+    return e == ESP_OK;
+}
+spi_transaction_t *SPICreate::getResult(int deviceHandle, TickType_t ticksToWait)
+{
+    spi_transaction_t *transaction = NULL;
+    if (queued[deviceHandle] == 0)
+    {
+        return NULL;
+    }
+    // a transaction cannot finish while another device holds the bus
+    lock();
+    if ((burstDevice != 0) && (burstDevice != deviceHandle))
+    {
+        releaseBus();
+    }
+    unlock();
+    // the wait itself does not need the lock; other tasks may use the bus meanwhile
+    esp_err_t e = spi_device_get_trans_result(handle[deviceHandle], &transaction, ticksToWait);
+    if (e != ESP_OK)
+    {
+        return NULL;
+    }
+    lock();
+    unsigned long start = queuedAt[deviceHandle][queuedHead[deviceHandle]];
+    queuedHead[deviceHandle] = (queuedHead[deviceHandle] + 1) & (SPI_QUEUE_MAX - 1);
+    queued[deviceHandle]--;
+    record(deviceHandle, transaction, 0, statStamp() - start, SPI_TRACE_QUEUED);
+    unlock();
+    return transaction;
+}
+int SPICreate::pending(int deviceHandle)
+{
+    return queued[deviceHandle];
+}
+void SPICreate::waitAll(int deviceHandle)
+{
+    while (queued[deviceHandle] > 0)
+    {
+        getResult(deviceHandle);
+    }
+}
+void *SPICreate::csUser(int deviceHandle)
+{
+    return (void *)(intptr_t)(CSs[deviceHandle] | (csHeld[deviceHandle] ? SPI_CS_HOLD : 0));
+}
+bool SPICreate::holdCS(int deviceHandle)
+{
+    if (hwCS[deviceHandle] || csHeld[deviceHandle])
+    {
+        return false;
+    }
+    lock();
+    waitAll(deviceHandle);
+    csHeld[deviceHandle] = true;
+    return true;
+}
+void SPICreate::releaseCS(int deviceHandle)
+{
+    if (!csHeld[deviceHandle])
+    {
+        return;
+    }
+    waitAll(deviceHandle);
+    csHeld[deviceHandle] = false;
+    digitalWrite(CSs[deviceHandle], HIGH);
+    unlock();
+}
+int SPICreate::reserveSlot(int deviceHandle, int size)
+{
+    uint8_t *buffer = NULL;
+    if (size > 0)
+    {
+        // round up so that the DMA never writes past the end of the buffer
+        buffer = (uint8_t *)heap_caps_malloc((size + 3) & ~3, MALLOC_CAP_DMA);
+        if (buffer == NULL)
+        {
+            return -1;
+        }
+        memset(buffer, 0, (size + 3) & ~3);
+    }
+    lock();
+    if (slotNum >= 16)
+    {
+        unlock();
+        heap_caps_free(buffer);
+        return -1;
+    }
+    int slot = slotNum++;
+    slot_buffer[slot] = buffer;
+    slot_transaction[slot] = {};
+    slot_transaction[slot].base.user = csUser(deviceHandle);
+    slot_transaction[slot].base.rx_buffer = buffer;
+    unlock();
+    return slot;
+}
+spi_transaction_ext_t *SPICreate::slotTransaction(int slot)
+{
+    return &slot_transaction[slot];
+}
+uint8_t *SPICreate::slotBuffer(int slot)
+{
+    return slot_buffer[slot];
+}
+void SPICreate::record(int deviceHandle, spi_transaction_t *transaction, unsigned long wait, unsigned long latency, uint8_t flags)
+{
+#if SPICREATE_TRACE
+    if (trace_buf != NULL)
+    {
+        trace(deviceHandle, transaction, latency, flags);
+    }
+#endif
+#if SPICREATE_STATS
+    SPIStats &st = stat[deviceHandle];
+    st.transactions++;
+    st.txBytes += transactionBits(transaction) / 8;
+    if (flags & SPI_TRACE_POLLED)
+    {
+        st.polled++;
+        st.pollTime += latency;
+    }
+    if ((transaction->flags & SPI_TRANS_USE_RXDATA) || (transaction->rx_buffer != NULL))
+    {
+        st.rxBytes += ((transaction->rxlength != 0) ? transaction->rxlength : transaction->length) / 8;
+    }
+    st.waitTime += wait;
+    st.busyTime += latency;
+    int bucket = (latency < 2) ? 0 : (31 - __builtin_clz((uint32_t)latency));
+    st.latency[(bucket > 15) ? 15 : bucket]++;
+#endif
+}
+const SPIStats &SPICreate::stats(int deviceHandle)
+{
+    return stat[deviceHandle];
+}
+void SPICreate::resetStats(int deviceHandle)
+{
+    lock();
+    for (int i = 1; i < 10; i++)
+    {
+        if ((deviceHandle == 0) || (deviceHandle == i))
+        {
+            stat[i] = {};
+        }
+    }
+    unlock();
+}
+void SPICreate::printStats(Print &out)
+{
+    lock();
+    for (int i = 1; (i <= deviceNum) && (i < 10); i++)
+    {
+        SPIStats st = stat[i];
+        out.printf("dev%d cs%d n=%u tx=%llu rx=%llu wait=%lluus busy=%lluus polled=%u/%lluus\n", i, CSs[i],
+                   (unsigned)st.transactions, (unsigned long long)st.txBytes, (unsigned long long)st.rxBytes,
+                   (unsigned long long)st.waitTime, (unsigned long long)st.busyTime,
+                   (unsigned)st.polled, (unsigned long long)st.pollTime);
+        out.printf("  us:");
+        for (int b = 0; b < 16; b++)
+        {
+            out.printf(" %u", (unsigned)st.latency[b]);
+        }
+        out.printf("\n");
+    }
+    unlock();
+}
+bool SPICreate::traceBegin(size_t bytes, uint8_t payload)
+{
+#if SPICREATE_TRACE
+    traceEnd();
+    uint8_t *buffer = (uint8_t *)heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+    if (buffer == NULL)
+    {
+        return false;
+    }
+    lock();
+    trace_buf = buffer;
+    trace_size = bytes;
+    trace_payload = payload;
+    unlock();
+    traceClear();
+    return true;
+#else
+    return false;
+#endif
+}
+void SPICreate::traceEnd()
+{
+    lock();
+    uint8_t *buffer = trace_buf;
+    trace_buf = NULL;
+    trace_size = 0;
+    unlock();
+    heap_caps_free(buffer);
+}
+void SPICreate::traceClear()
+{
+    lock();
+    trace_head = 0;
+    trace_tail = 0;
+    trace_used = 0;
+    trace_dropped = 0;
+    unlock();
+}
+size_t SPICreate::traceUsed()
+{
+    return trace_used;
+}
+uint32_t SPICreate::traceDropped()
+{
+    return trace_dropped;
+}
+void SPICreate::tracePut(const void *data, size_t n)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < n; i++)
+    {
+        trace_buf[trace_head] = p[i];
+        trace_head = (trace_head + 1 == trace_size) ? 0 : trace_head + 1;
+    }
+    trace_used += n;
+}
+void SPICreate::traceGet(size_t pos, void *data, size_t n)
+{
+    uint8_t *p = (uint8_t *)data;
+    for (size_t i = 0; i < n; i++)
+    {
+        p[i] = trace_buf[(pos + i) % trace_size];
+    }
+}
+void SPICreate::trace(int deviceHandle, spi_transaction_t *transaction, unsigned long latency, uint8_t flags)
+{
+    spi_transaction_ext_t *ext = (spi_transaction_ext_t *)transaction;
+    const uint8_t *tx = (transaction->flags & SPI_TRANS_USE_TXDATA) ? transaction->tx_data : (const uint8_t *)transaction->tx_buffer;
+    const uint8_t *rx = (transaction->flags & SPI_TRANS_USE_RXDATA) ? transaction->rx_data : (const uint8_t *)transaction->rx_buffer;
+    size_t length = transaction->length / 8;
+    size_t rxLength = ((transaction->rxlength != 0) ? transaction->rxlength : transaction->length) / 8;
+
+    SPITraceRecord r = {};
+    r.time = micros() - latency;
+    r.duration = (latency > 0xFFFF) ? 0xFFFF : latency;
+    r.device = deviceHandle;
+    r.flags = flags;
+    r.cmd = transaction->cmd;
+    r.prefix = ((transaction->flags & SPI_TRANS_VARIABLE_CMD) ? ext->command_bits / 8 : 0) +
+               ((transaction->flags & SPI_TRANS_VARIABLE_ADDR) ? ext->address_bits / 8 : 0) +
+               ((transaction->flags & SPI_TRANS_VARIABLE_DUMMY) ? ext->dummy_bits / 8 : 0);
+    r.addr = transaction->addr;
+    r.length = (length > 0xFFFF) ? 0xFFFF : length;
+    r.txStored = (tx == NULL) ? 0 : ((length < trace_payload) ? length : trace_payload);
+    r.rxStored = (rx == NULL) ? 0 : ((rxLength < trace_payload) ? rxLength : trace_payload);
+
+    size_t need = sizeof(r) + r.txStored + r.rxStored;
+    if (need > trace_size)
+    {
+        return;
+    }
+    // overwrite whole records from the oldest end
+    while (trace_size - trace_used < need)
+    {
+        SPITraceRecord old;
+        traceGet(trace_tail, &old, sizeof(old));
+        size_t n = sizeof(old) + old.txStored + old.rxStored;
+        trace_tail = (trace_tail + n) % trace_size;
+        trace_used -= n;
+        trace_dropped++;
+    }
+    tracePut(&r, sizeof(r));
+    tracePut(tx, r.txStored);
+    tracePut(rx, r.rxStored);
+}
+void SPICreate::traceDump(Print &out)
+{
+    lock();
+    out.printf("#SPITRACE %u\n", (unsigned)trace_dropped);
+    for (int i = 1; (i <= deviceNum) && (i < 10); i++)
+    {
+        out.printf("#SPIDEV %d %d\n", i, CSs[i]);
+    }
+    size_t pos = trace_tail;
+    size_t left = (trace_buf != NULL) ? trace_used : 0;
+    while (left > 0)
+    {
+        SPITraceRecord r;
+        traceGet(pos, &r, sizeof(r));
+        size_t n = sizeof(r) + r.txStored + r.rxStored;
+        out.printf("#SPI ");
+        for (size_t i = 0; i < n; i++)
+        {
+            out.printf("%02X", trace_buf[(pos + i) % trace_size]);
+        }
+        out.printf("\n");
+        pos = (pos + n) % trace_size;
+        left -= n;
+    }
+    out.printf("#SPIEND\n");
+    unlock();
+}
+void SPICreate::beginBurst()
+{
+    lock();
+    if (burstDepth++ == 0)
+    {
+        burstHeld = 0;
+    }
+}
+unsigned long SPICreate::endBurst()
+{
+    if (burstDepth == 0)
+    {
+        return 0;
+    }
+    if (--burstDepth > 0)
+    {
+        unlock();
+        return 0;
+    }
+    releaseBus();
+    lastBurst = burstHeld;
+    if (lastBurst > maxBurst)
+    {
+        maxBurst = lastBurst;
+    }
+    unlock();
+    return lastBurst;
+}
+unsigned long SPICreate::lastBurstTime()
+{
+    return lastBurst;
+}
+unsigned long SPICreate::maxBurstTime()
+{
+    return maxBurst;
+}
+void SPICreate::holdBus(int deviceHandle)
+{
+    if ((burstDepth == 0) || (burstDevice == deviceHandle))
+    {
+        return;
+    }
+    releaseBus();
+    if (spi_device_acquire_bus(handle[deviceHandle], portMAX_DELAY) == ESP_OK)
+    {
+        burstDevice = deviceHandle;
+        holdStart = micros();
+    }
+}
+void SPICreate::releaseBus()
+{
+    if (burstDevice == 0)
+    {
+        return;
+    }
+    spi_device_release_bus(handle[burstDevice]);
+    burstHeld += micros() - holdStart;
+    burstDevice = 0;
+}
+void SPICreate::drain(int deviceHandle)
+{
+    // the blocking driver calls must not run while queued results are outstanding
+    if (queued[deviceHandle] > 0)
+    {
+        waitAll(deviceHandle);
+    }
+}
 SPICREATE_END
\ No newline at end of file
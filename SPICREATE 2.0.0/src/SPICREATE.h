@@ -7,8 +7,24 @@
 #include <Arduino.h>
 #include <SPI.h>
 #include <driver/spi_master.h>
-#include <deque>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 
+// Per-device bus telemetry. Build with -DSPICREATE_STATS=0 to compile the hooks out.
+#ifndef SPICREATE_STATS
+#define SPICREATE_STATS 1
+#endif
+// Bus trace recorder (traceBegin). Build with -DSPICREATE_TRACE=0 to compile it out.
+#ifndef SPICREATE_TRACE
+#define SPICREATE_TRACE 1
+#endif
+
+// ORed into the CS pin in spi_transaction_t::user: csSet leaves CS low (SPICreate::holdCS)
+const intptr_t SPI_CS_HOLD = 0x10000;
 void csSet(spi_transaction_t *t);
 void csReset(spi_transaction_t *t);
 namespace arduino
@@ -20,10 +36,67 @@ namespace arduino
             namespace dma
             {
 
+                enum SPIPriority
+                {
+                    SPI_PRIORITY_NORMAL,
+                    SPI_PRIORITY_LOW, // long reads are split so other tasks get in between
+                };
+
+                struct SPIStats
+                {
+                    uint32_t transactions;
+                    uint64_t txBytes;  // bytes clocked out, command and address included
+                    uint64_t rxBytes;  // bytes stored to the receive buffer
+                    uint64_t waitTime; // us spent waiting for the bus lock
+                    uint64_t busyTime; // us from start to completion of the transfers
+                    uint32_t polled;   // transactions run with polling instead of the interrupt
+                    uint64_t pollTime; // us the CPU spun in those
+                    // latency histogram: latency[0] counts < 2us, latency[i] counts
+                    // [2^i, 2^(i+1)) us, and the last bucket takes everything longer
+                    uint32_t latency[16];
+                };
+
+                // One transaction in the trace ring, followed by txStored tx bytes and rxStored
+                // rx bytes of the data phase. Little endian, as on the ESP32.
+                struct __attribute__((packed)) SPITraceRecord
+                {
+                    uint32_t time;     // micros() at the start of the transfer
+                    uint16_t duration; // us, 0xFFFF if longer
+                    uint8_t device;
+                    uint8_t flags;  // SPI_TRACE_*
+                    uint16_t cmd;
+                    uint8_t prefix; // command, address and dummy bytes before the data phase
+                    uint8_t reserved;
+                    uint32_t addr;
+                    uint16_t length; // data phase bytes
+                    uint8_t txStored;
+                    uint8_t rxStored;
+                };
+                const uint8_t SPI_TRACE_POLLED = 0x01;
+                const uint8_t SPI_TRACE_QUEUED = 0x02; // duration runs from queueing to collection
+
+                // Deepest queue a device gets: the queue times of its outstanding transactions
+                // are kept in a ring of this size (a power of two).
+                const int SPI_QUEUE_MAX = 8;
+
+                // One data-ready read (captureOn). time is esp_timer_get_time() in the interrupt,
+                // latency the us from there until the read has finished, and wait the part of it
+                // the capture task spent waiting for the bus lock.
+                const int SPI_CAPTURE_BYTES = 32;
+                struct SPICapture
+                {
+                    int64_t time;
+                    uint32_t latency;
+                    uint32_t wait;
+                    uint8_t length;
+                    uint8_t data[SPI_CAPTURE_BYTES];
+                };
+
                 class SPICreate
                 {
                     spi_bus_config_t bus_cfg = {};
                     spi_device_handle_t handle[10];
+                    spi_device_interface_config_t devcfg[10]; // as added, for setClock()
                     int CSs[10];
                     int deviceNum{0};
                     spi_host_device_t host{HSPI_HOST};
@@ -32,25 +105,274 @@ namespace arduino
                     int max_size{4094};      // default size
                     uint32_t frequency{SPI_MASTER_FREQ_8M};
 
-                    std::deque<spi_transaction_t> transactions;
-                    int queue_size{1};
+                    // chip select driven by the SPI peripheral (spics_io_num), at most 3 per host
+                    bool hardware_cs{false};
+                    uint8_t cs_pretrans{0};
+                    uint8_t cs_posttrans{0};
+                    bool hwCS[10] = {};
+                    int hwCSNum{0};
+
+                    // WP/HD (IO2/IO3) for quad transfers, -1: not wired
+                    int8_t quad_wp{-1};
+                    int8_t quad_hd{-1};
+
+                    int poll_threshold{32}; // transfer() polls up to this many bytes
+                    int queue_size{2};      // minimum queue depth given to each device
+                    int queued[10] = {};    // transactions queued and not yet collected
+
+                    void drain(int deviceHandle);
+                    // software CS kept low between transactions (holdCS)
+                    bool csHeld[10] = {};
+                    void *csUser(int deviceHandle);
+                    void probeRead(const spi_transaction_ext_t *probes, int n, uint8_t *out, int deviceHandle);
+
+                    // preallocated DMA-capable buffers, each with a reusable transaction
+                    spi_transaction_ext_t slot_transaction[16];
+                    uint8_t *slot_buffer[16] = {};
+                    int slotNum{0};
+
+                    SPIPriority priority[10] = {};
+                    int chunk_size[10] = {};
+                    bool chunkable(spi_transaction_t *transaction, int deviceHandle);
+                    void transferChunked(spi_transaction_t *transaction, int deviceHandle);
+
+                    // register access rules per device
+                    bool autoIncrement[10] = {};
+                    uint8_t incrementBit[10] = {};
+                    uint8_t readBit[10] = {};
+
+                    // burst mode state
+                    int burstDepth{0};
+                    int burstDevice{0}; // device currently holding the bus, 0: none
+                    unsigned long holdStart{0};
+                    unsigned long burstHeld{0};
+                    unsigned long lastBurst{0};
+                    unsigned long maxBurst{0};
+
+                    void holdBus(int deviceHandle);
+                    void releaseBus();
+
+                    // Every call that touches the bus or the tables above runs under this
+                    // recursive mutex. FreeRTOS queues waiters by priority and applies priority
+                    // inheritance, so a high-priority task is next in line and never stuck
+                    // behind a preempted low-priority holder.
+                    SemaphoreHandle_t busLock{NULL};
+
+                    uint8_t *trace_buf{NULL};
+                    size_t trace_size{0};
+                    size_t trace_head{0}; // next byte to write
+                    size_t trace_tail{0}; // oldest record
+                    size_t trace_used{0};
+                    uint8_t trace_payload{16};
+                    uint32_t trace_dropped{0};
+                    void trace(int deviceHandle, spi_transaction_t *transaction, unsigned long latency, uint8_t flags);
+
+                    // data-ready capture (beginCapture)
+                    struct SPICaptureSource
+                    {
+                        SPICreate *spi;
+                        int deviceHandle;
+                    };
+                    TaskHandle_t captureHandle{NULL};
+                    SemaphoreHandle_t captureDone{NULL};
+                    volatile bool captureStop{false};
+                    portMUX_TYPE captureMux = portMUX_INITIALIZER_UNLOCKED;
+                    volatile uint32_t capturePending{0}; // bit per device, set by captureFromISR()
+                    volatile int64_t captureTime[10] = {};
+                    SPICaptureSource captureSource[10] = {};
+                    int captureSlot[10] = {};
+                    int capturePin[10] = {};
+                    QueueHandle_t captures[10] = {};
+                    volatile uint32_t captureDropped[10] = {};
+                    static void captureTask(void *arg);
+                    static void captureISR(void *arg);
+                    void capture(int deviceHandle, int64_t time);
+                    void tracePut(const void *data, size_t n);
+                    void traceGet(size_t pos, void *data, size_t n);
+
+                    SPIStats stat[10] = {};
+                    unsigned long queuedAt[10][SPI_QUEUE_MAX] = {}; // queue time of outstanding transactions
+                    uint8_t queuedHead[10] = {};
+                    void record(int deviceHandle, spi_transaction_t *transaction, unsigned long wait, unsigned long latency, uint8_t flags = 0);
 
                 public:
                     bool begin(uint8_t spi_bus = HSPI, int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, uint32_t f = 8000000);
                     bool end();
+                    // Call before begin() to wire IO2/IO3 for SPI_TRANS_MODE_QIO transfers (half-duplex
+                    // devices only). IOMUX pins: HSPI wp 2, hd 4; VSPI wp 22, hd 21.
+                    void setQuadPins(int8_t wp, int8_t hd);
+                    bool quadPins();
 
-                    int addDevice(spi_device_interface_config_t *if_cfg, int cs);
+                    // softwareCS keeps the device on csReset/csSet even while setHardwareCS is on, e.g.
+                    // for a second device on the same CS pin (a GPIO can only feed one CS signal)
+                    int addDevice(spi_device_interface_config_t *if_cfg, int cs, bool softwareCS = false);
                     bool rmDevice(int deviceHandle);
 
+                    // Re-adds the device at another clock; false (and the old clock) if IDF refuses it,
+                    // e.g. above 26.7 MHz full duplex on GPIO matrix pins.
+                    bool setClock(int deviceHandle, uint32_t hz);
+                    uint32_t deviceClock(int deviceHandle);
+                    // Finds the fastest clock the device reads reliably at on this board. probes are
+                    // reads of something that does not change meanwhile (WHO_AM_I, RDID, registers
+                    // written in begin(), at most 64 bytes in all); what they return at the first
+                    // step is the reference. The clock steps up through 80 MHz / n from minHz to
+                    // maxHz, and each step reads every probe `tries` times. When a step returns
+                    // something else, the device is set marginPercent below the last good step;
+                    // when all pass, or IDF refuses the next step, to the last good step. Returns
+                    // the clock, or 0 (and the old clock) if the device reads all 0x00 or 0xFF or
+                    // fails at the first step.
+                    uint32_t probeClock(int deviceHandle, const spi_transaction_ext_t *probes, int n, uint32_t maxHz,
+                                        uint32_t minHz = 1000000, int tries = 16, int marginPercent = 20);
+
+                    // Devices added while enabled get spics_io_num = cs, so the peripheral drives CS
+                    // with no GPIO writes or callbacks per transaction; csReset/csSet are dropped from
+                    // their config. pretrans/posttrans are SPI clock cycles CS is held before/after the
+                    // data (pretrans above 1 is only allowed on half-duplex devices and is cut to 1 on
+                    // the others). A host has 3 CS lines, later devices stay on software CS.
+                    void setHardwareCS(bool enable, uint8_t pretrans = 0, uint8_t posttrans = 0);
+
+                    // Data-ready capture. An interrupt may not touch IDF's SPI master (it takes
+                    // locks and may block), and neither pollTransmit() nor readByte() can run there.
+                    // So captureFromISR() only takes the time and wakes a capture task; the task
+                    // runs above every other bus user and reads the device's slot right away with
+                    // polling. Make the handler and whatever it calls IRAM_ATTR.
+                    bool beginCapture(UBaseType_t priority = configMAX_PRIORITIES - 1, BaseType_t core = tskNO_AFFINITY,
+                                      uint32_t stackSize = 4096);
+                    void endCapture(); // also detaches the pins given to captureOn()
+                    // From now on every read of slot is queued for getCapture(), up to depth of them.
+                    // pin >= 0 attaches the interrupt (e.g. the sensor's data-ready line on RISING);
+                    // -1 leaves it to the caller to call captureFromISR() from its own handler or a
+                    // hardware timer.
+                    bool captureOn(int deviceHandle, int slot, int pin = -1, int mode = RISING, int depth = 16);
+                    void captureFromISR(int deviceHandle);
+                    bool getCapture(int deviceHandle, SPICapture *out, TickType_t ticksToWait = portMAX_DELAY);
+                    // interrupts that came before the previous one was read, and reads the queue had no room for
+                    uint32_t capturesDropped(int deviceHandle);
+
+                    // Holds the bus for a sequence of calls from one task (e.g. WREN + program).
+                    // Calls made by the same task nest.
+                    bool lock(TickType_t ticksToWait = portMAX_DELAY);
+                    void unlock();
+
                     uint8_t readByte(uint8_t addr, int deviceHandle);
                     void sendCmd(uint8_t cmd, int deviceHandle);
                     void setReg(uint8_t addr, uint8_t data, int deviceHandle);
+                    // Writes (addr, value) pairs in order. Runs of consecutive addresses are sent as
+                    // one burst when the device auto-increments. Every write is sent: trigger and
+                    // reset registers are often written twice on purpose. With dropRepeats, a write
+                    // that repeats the value already written to that address earlier in the list is
+                    // left out. Addresses are not bank aware, so one list must stay within a single
+                    // register bank (select the bank before the call, not inside the list).
+                    void setRegs(const uint8_t (*regs)[2], int n, int deviceHandle, bool dropRepeats = false);
+                    void setRegs(uint8_t addr, const uint8_t *data, int n, int deviceHandle);
+                    // The device auto-increments the register address in multi-byte accesses
+                    // when incrementBit is ORed into it (0x40 for ST sensors, 0 for InvenSense).
+                    void setAutoIncrement(int deviceHandle, uint8_t bit = 0);
+                    // Register read flag ORed into the address, 0x80 unless set otherwise.
+                    void setReadBit(int deviceHandle, uint8_t bit);
+                    // Reads n consecutive registers in one transaction when the device
+                    // auto-increments, one register at a time otherwise.
+                    void readRegs(uint8_t addr, uint8_t *data, int n, int deviceHandle);
+
+                    const SPIStats &stats(int deviceHandle);
+                    void resetStats(int deviceHandle = 0); // 0: all devices
+                    void printStats(Print &out = Serial);
+
+                    // Records every transaction into a RAM ring of `bytes` bytes, keeping up to
+                    // `payload` tx and rx bytes of each; the oldest records are overwritten when it
+                    // is full. Durations come from the stats clock, so SPICREATE_STATS must be on.
+                    bool traceBegin(size_t bytes = 16384, uint8_t payload = 16);
+                    void traceEnd();
+                    void traceClear();
+                    size_t traceUsed();
+                    uint32_t traceDropped(); // records overwritten since traceBegin/traceClear
+                    // Text dump for host/examples/trace_replay.cpp: "#SPITRACE <dropped>",
+                    // "#SPIDEV <device> <cs>" per device, "#SPI <record in hex>" per record, "#SPIEND".
+                    void traceDump(Print &out = Serial);
+
+                    // Burst mode keeps the bus acquired between transactions of a sampling frame.
+                    // The frame also holds lock(), so other tasks wait until it ends.
+                    // IDF can only lock the bus for one device, so it is handed over (released and
+                    // acquired) when the frame moves on to the next device. The hand-over waits for
+                    // the previous device's queued transactions, so queueing to several devices in
+                    // one frame does not overlap them; use plain transfers in a burst.
+                    // endBurst() returns how long the frame held the bus in microseconds.
+                    void beginBurst();
+                    unsigned long endBurst();
+                    unsigned long lastBurstTime();
+                    unsigned long maxBurstTime();
 
                     void transmit(uint8_t *tx, int size, int deviceHandle);
                     void transmit(uint8_t *tx, uint8_t *rx, int size, int deviceHandle);
                     void transmit(spi_transaction_t *transaction, int deviceHandle);
 
                     void pollTransmit(spi_transaction_t *transaction, int deviceHandle);
+
+                    // Picks the mechanism from the size on the wire (command, address and dummy
+                    // included). Up to pollThreshold() bytes the CPU polls, which skips the
+                    // interrupt and task switch; longer transfers go through the interrupt and DMA
+                    // and the task sleeps meanwhile. Compare stats().polled/pollTime against
+                    // busyTime to tune the threshold; 0 never polls.
+                    void transfer(spi_transaction_t *transaction, int deviceHandle);
+                    void setPollThreshold(int bytes);
+                    int pollThreshold();
+
+                    // transfer() to a SPI_PRIORITY_LOW device splits reads with an address phase
+                    // (flash reads) into chunkSize byte reads at consecutive addresses and gives
+                    // the lock up in between, so a sensor read from another task waits for one
+                    // chunk instead of the whole transfer. Writes are never split: a page program
+                    // has to be one transaction. No effect while the caller holds lock() or a burst.
+                    void setPriority(int deviceHandle, SPIPriority p, int chunkSize = 32);
+                    SPIPriority devicePriority(int deviceHandle);
+                    int chunkSize(int deviceHandle);
+
+                    // Non-blocking transfers. The transaction (and its buffers) must stay valid
+                    // until it is returned by getResult(). Blocking calls to the same device
+                    // collect its queued transactions first. Queued transactions belong to the
+                    // task that queued them; only that task should collect them.
+                    void setQueueSize(int size); // call before addDevice, 1 to SPI_QUEUE_MAX
+                    bool queueTransmit(spi_transaction_t *transaction, int deviceHandle, TickType_t ticksToWait = portMAX_DELAY);
+                    spi_transaction_t *getResult(int deviceHandle, TickType_t ticksToWait = portMAX_DELAY);
+                    int pending(int deviceHandle);
+                    void waitAll(int deviceHandle);
+
+                    // Keeps the device selected from its next transaction until releaseCS(), so one
+                    // command can go on over several transactions (a flash continuous read: the
+                    // command and address once, then data-only transactions). Any other transfer on
+                    // the bus would clock the selected device, so lock() is held meanwhile. Software
+                    // CS only: false for devices on hardware CS, or if already held.
+                    bool holdCS(int deviceHandle);
+                    void releaseCS(int deviceHandle); // collects queued transactions, raises CS, unlocks
+
+                    // Drivers reserve a slot in begin() and reuse its transaction for every sample.
+                    // The buffer is word aligned and MALLOC_CAP_DMA, so IDF never has to bounce it.
+                    int reserveSlot(int deviceHandle, int size);
+                    spi_transaction_ext_t *slotTransaction(int slot);
+                    uint8_t *slotBuffer(int slot);
+                };
+
+                // Holds the bus for the lifetime of the object. spi may be NULL.
+                class SPIBurst
+                {
+                    SPICreate *spi;
+
+                public:
+                    SPIBurst(SPICreate *target) : spi(target)
+                    {
+                        if (spi != NULL)
+                        {
+                            spi->beginBurst();
+                        }
+                    }
+                    ~SPIBurst()
+                    {
+                        if (spi != NULL)
+                        {
+                            spi->endBurst();
+                        }
+                    }
+                    SPIBurst(const SPIBurst &) = delete;
+                    SPIBurst &operator=(const SPIBurst &) = delete;
                 };
             } // dma
         }     // spi
@@ -76,4 +398,11 @@ namespace arduino
     }
 #endif
 namespace SPICREATE = arduino::esp32::spi::dma;
+// pastes a and b after expanding them, for preprocessor tests on a macro's value
+#ifndef SPICREATE_CONCAT
+#define SPICREATE_CONCAT_(a, b) a##b
+#define SPICREATE_CONCAT(a, b) SPICREATE_CONCAT_(a, b)
+#endif
+#include "SPIDevice.h"
+#include "SPIBudget.h"
 #endif
@@ -0,0 +1,149 @@
+#pragma once
+
+#ifndef SPIDEVICE_H
+#define SPIDEVICE_H
+#include "SPICREATE.h"
+
+// Compile-time device descriptors. A driver describes its chip once,
+//
+//     struct H3LIS331Device : SPICREATE::SPIDevice<SPI_MODE0, 10000000, 0x80, 0x40>
+//     {
+//         typedef SPICREATE::SPIBlock<0x28, 6, SPICREATE::SPI_LITTLE_ENDIAN, 0, 2, 4> Data;
+//     };
+//
+// and begin()/Get() become add(), reserve<Data>() and Data::decode(). Everything is a
+// template argument, so the command byte, the length and the byte order of every sample
+// read are constants in the generated code.
+namespace arduino
+{
+    namespace esp32
+    {
+        namespace spi
+        {
+            namespace dma
+            {
+                enum SPIByteOrder
+                {
+                    SPI_LITTLE_ENDIAN,
+                    SPI_BIG_ENDIAN
+                };
+
+                // int16_t words at the given byte offsets of a raw block
+                template <SPIByteOrder Order, int... Offsets>
+                struct SPIWords;
+
+                template <SPIByteOrder Order>
+                struct SPIWords<Order>
+                {
+                    static void decode(const uint8_t *raw, int16_t *out) {}
+                };
+
+                template <SPIByteOrder Order, int Offset, int... Rest>
+                struct SPIWords<Order, Offset, Rest...>
+                {
+                    static void decode(const uint8_t *raw, int16_t *out)
+                    {
+                        out[0] = (Order == SPI_BIG_ENDIAN) ? (int16_t)(raw[Offset] << 8 | raw[Offset + 1])
+                                                           : (int16_t)(raw[Offset + 1] << 8 | raw[Offset]);
+                        SPIWords<Order, Rest...>::decode(raw, out + 1);
+                    }
+                };
+
+                // Length bytes read in one transaction from register Address on; decode() turns
+                // the words at Offsets into int16_t. Bytes not listed (e.g. temperature between
+                // accel and gyro) are read but not decoded.
+                template <uint8_t Address, int Length, SPIByteOrder Order, int... Offsets>
+                struct SPIBlock
+                {
+                    static constexpr uint8_t address = Address;
+                    static constexpr int length = Length;
+                    static constexpr int words = sizeof...(Offsets);
+
+                    static void decode(const uint8_t *raw, int16_t *out)
+                    {
+                        SPIWords<Order, Offsets...>::decode(raw, out);
+                    }
+                };
+
+                // Mode: SPI_MODE0..3. MaxClock: the chip's limit, add() caps the requested clock
+                // at it. ReadBit: ORed into the register address for reads. IncrementBit: ORed in
+                // for multi-byte accesses, 0 when the address increments on its own.
+                template <uint8_t Mode, uint32_t MaxClock, uint8_t ReadBit, uint8_t IncrementBit>
+                struct SPIDevice
+                {
+                    static constexpr uint8_t mode = Mode;
+                    static constexpr uint32_t maxClock = MaxClock;
+                    static constexpr uint8_t readBit = ReadBit;
+                    static constexpr uint8_t incrementBit = IncrementBit;
+
+                    // addDevice() on software CS (csReset/csSet), then setAutoIncrement() and
+                    // setReadBit(). Returns the device handle.
+                    static int add(SPICreate *spi, int cs, uint32_t freq)
+                    {
+                        spi_device_interface_config_t if_cfg = {};
+                        if_cfg.spics_io_num = -1;
+                        if_cfg.clock_speed_hz = (freq < MaxClock) ? freq : MaxClock;
+                        if_cfg.mode = Mode;
+                        if_cfg.queue_size = 1;
+                        if_cfg.pre_cb = csReset;
+                        if_cfg.post_cb = csSet;
+                        int deviceHandle = spi->addDevice(&if_cfg, cs);
+                        spi->setAutoIncrement(deviceHandle, IncrementBit);
+                        spi->setReadBit(deviceHandle, ReadBit);
+                        return deviceHandle;
+                    }
+
+                    // The command byte that reads Block.
+                    template <typename Block>
+                    static uint8_t command()
+                    {
+                        return Block::address | ReadBit | ((Block::length > 1) ? IncrementBit : 0);
+                    }
+
+                    // The transaction that reads Block, without a buffer.
+                    template <typename Block>
+                    static spi_transaction_ext_t transaction()
+                    {
+                        spi_transaction_ext_t t = {};
+                        t.base.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+                        t.base.length = Block::length * 8;
+                        t.base.cmd = command<Block>();
+                        t.command_bits = 8;
+                        return t;
+                    }
+
+                    // A slot whose transaction reads Block; -1 if no slot is left.
+                    template <typename Block>
+                    static int reserve(SPICreate *spi, int deviceHandle)
+                    {
+                        int slot = spi->reserveSlot(deviceHandle, Block::length);
+                        if (slot >= 0)
+                        {
+                            spi_transaction_ext_t *t = spi->slotTransaction(slot);
+                            t->base.flags = SPI_TRANS_VARIABLE_CMD | SPI_TRANS_VARIABLE_ADDR;
+                            t->base.length = Block::length * 8;
+                            t->base.cmd = command<Block>();
+                            t->command_bits = 8;
+                        }
+                        return slot;
+                    }
+
+                    // SPICreate::probeClock() with Blocks as the probes (registers that keep their
+                    // value, e.g. WHO_AM_I and the configuration written in begin()).
+                    template <typename... Blocks>
+                    static uint32_t probe(SPICreate *spi, int deviceHandle, uint32_t maxHz)
+                    {
+                        const spi_transaction_ext_t probes[] = {transaction<Blocks>()...};
+                        return spi->probeClock(deviceHandle, probes, sizeof...(Blocks), maxHz);
+                    }
+
+                    static uint8_t read(SPICreate *spi, uint8_t addr, int deviceHandle)
+                    {
+                        return spi->readByte(addr | ReadBit, deviceHandle);
+                    }
+                };
+            } // dma
+        }     // spi
+    }         // esp32
+} // arduino
+#endif